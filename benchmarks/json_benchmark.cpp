@@ -0,0 +1,71 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "json.h"
+
+using namespace Graphics;
+
+/// <summary>
+/// Builds a glTF-like document of roughly the given size: large accessor, bufferView and node arrays
+/// with numbers, strings and nested objects, like the JSON chunk of a big scene.
+/// </summary>
+static std::string makeGltfDocument(size_t targetSize)
+{
+    std::ostringstream json;
+    json << "{\"asset\":{\"generator\":\"json_benchmark\",\"version\":\"2.0\"},\"nodes\":[";
+    for (size_t i = 0; json.tellp() < (std::streamoff) targetSize; i++)
+    {
+        json << (i ? "," : "")
+             << "{\"name\":\"node_" << i << "\",\"mesh\":" << i
+             << ",\"matrix\":[1.0,0.0,0.0,0.0,0.0,0.0,-1.0,0.0,0.0,1.0,0.0,0.0,"
+             << i * 0.25 << "," << i * -0.5 << "," << i * 1.125 << ",1.0]"
+             << ",\"accessor\":{\"bufferView\":" << i << ",\"byteOffset\":" << i * 288
+             << ",\"componentType\":5126,\"count\":24,\"max\":[1.0,1.0,1.0],\"min\":[-1.0,-1.0,-1.0],"
+             << "\"type\":\"VEC3\",\"normalized\":false,\"extras\":null}}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+int main(int argc, char** argv)
+{
+    std::string text;
+    if (argc > 1)
+    {
+        std::ifstream file(argv[1], std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "Unable to read " << argv[1] << std::endl;
+            return 1;
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        text = stream.str();
+    }
+    else
+    {
+        text = makeGltfDocument(8 << 20);
+    }
+    int iterations = argc > 2 ? std::stoi(argv[2]) : 20;
+
+    // Warm up once, and keep the node count so the parse cannot be optimized away
+    size_t nodeCount = JSON::loadString(text).getNodeCount();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        nodeCount += JSON::loadString(text).getNodeCount();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double megabytes = (double) text.size() * iterations / (1024.0 * 1024.0);
+    std::cout << "Parsed " << text.size() << " bytes x " << iterations << " ("
+              << nodeCount / (iterations + 1) << " nodes each)" << std::endl;
+    std::cout << "Average: " << seconds * 1000.0 / iterations << " ms, "
+              << megabytes / seconds << " MB/s" << std::endl;
+
+    return 0;
+}
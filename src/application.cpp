@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
@@ -8,6 +9,8 @@
 #endif
 
 #define MIN_ZOOM_DISTANCE 2.0
+#define INSTANCE_GRID_SIZE 32
+#define PREVIEW_MIN_PROGRESS 0.5        // A load replaces the current model with its preview once this far along
 
 namespace Graphics
 {
@@ -21,8 +24,18 @@ namespace Graphics
     static bool bDrawVertices = false;
     static bool bDisplayDebugText = true;
     static bool bDisplayFps = true;
+    static bool bOptimizeMeshes = true;
+    static bool bUseLods = true;
+    static bool bCullBackfaces = true;
+    static bool bGouraud = false;
+    static bool bInstanceGrid = false;
+    static bool bOcclusionCulling = true;
+    static bool bHoverIds = false;
+    static RenderMode renderMode = RenderMode::Automatic;
+    static ShadowMode shadowMode = ShadowMode::Off;
 
     static bool MOUSE_DOWN = false;
+    static bool MOUSE_CLICKED = false;
     static bool W_DOWN = false;
     static bool A_DOWN = false;
     static bool S_DOWN = false;
@@ -76,6 +89,7 @@ namespace Graphics
         case WM_LBUTTONDOWN:
         {
             MOUSE_DOWN = true;
+            MOUSE_CLICKED = true;
             Point mousePos = app->getMousePos();
             app->setMouseClickPos(mousePos.x, mousePos.y);
             break;
@@ -137,6 +151,35 @@ namespace Graphics
             case 'F':
                 bDisplayFps = !bDisplayFps;
                 break;
+            case 'M':
+                bOptimizeMeshes = !bOptimizeMeshes;
+                break;
+            case 'L':
+                bUseLods = !bUseLods;
+                break;
+            case 'B':
+                bCullBackfaces = !bCullBackfaces;
+                break;
+            case 'G':
+                bGouraud = !bGouraud;
+                break;
+            case 'I':
+                bInstanceGrid = !bInstanceGrid;
+                break;
+            case 'C':
+                bOcclusionCulling = !bOcclusionCulling;
+                break;
+            case 'H':
+                bHoverIds = !bHoverIds;
+                break;
+            case 'R':
+                renderMode = renderMode == RenderMode::Automatic ? RenderMode::Rasterize :
+                             renderMode == RenderMode::Rasterize ? RenderMode::RayTrace : RenderMode::Automatic;
+                break;
+            case 'P':
+                shadowMode = shadowMode == ShadowMode::Off ? ShadowMode::RayTraced :
+                             shadowMode == ShadowMode::RayTraced ? ShadowMode::Mapped : ShadowMode::Off;
+                break;
             case VK_ESCAPE:
                 ESC_DOWN = true;
                 break;
@@ -288,6 +331,10 @@ namespace Graphics
         // Initialize our framebuffer
         m_buffer = new Framebuffer(m_hwnd);
         m_buffer->setSize(DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT);
+
+        // Build the scene
+        m_cameraNode = m_scene.addNode(m_buffer->getCamera());
+        m_staticMeshNode = m_scene.addNode(m_staticMesh);
     }
 
     int Application::run()
@@ -300,6 +347,7 @@ namespace Graphics
         if (m_buffer != nullptr)
         {
             m_buffer->getCamera()->move(Vector3(0, 0, 5.0));
+            m_scene.markDirty(m_cameraNode);
         }
 
         // Run the message loop.
@@ -311,7 +359,19 @@ namespace Graphics
             PrintBuffer::clear();
 
             // Print instructions
-            PrintBuffer::debugPrintToScreen("O: Load a .obj file");
+            PrintBuffer::debugPrintToScreen("O: Load a .obj or .glb file");
+            PrintBuffer::debugPrintToScreen("M: Optimize loaded meshes (%s)", bOptimizeMeshes ? "on" : "off");
+            PrintBuffer::debugPrintToScreen("L: Distance-based levels of detail (%s)", bUseLods ? "on" : "off");
+            PrintBuffer::debugPrintToScreen("B: Backface culling (%s)", bCullBackfaces ? "on" : "off");
+            PrintBuffer::debugPrintToScreen("G: Gouraud shading (%s)", bGouraud ? "on" : "off");
+            PrintBuffer::debugPrintToScreen("I: Draw a %ix%i grid of instances (%s)", INSTANCE_GRID_SIZE,
+                                            INSTANCE_GRID_SIZE, bInstanceGrid ? "on" : "off");
+            PrintBuffer::debugPrintToScreen("C: Occlusion culling of instances (%s)", bOcclusionCulling ? "on" : "off");
+            PrintBuffer::debugPrintToScreen("H: Show the triangle under the cursor (%s)", bHoverIds ? "on" : "off");
+            PrintBuffer::debugPrintToScreen("R: Render mode (%s)", renderMode == RenderMode::Automatic ? "automatic" :
+                                            renderMode == RenderMode::Rasterize ? "rasterize" : "ray trace");
+            PrintBuffer::debugPrintToScreen("P: Shadows (%s)", shadowMode == ShadowMode::Off ? "off" :
+                                            shadowMode == ShadowMode::RayTraced ? "ray traced" : "shadow map");
             PrintBuffer::debugPrintToScreen("T: Toggle text display");
             PrintBuffer::debugPrintToScreen("Left click + move: Orbit around");
             PrintBuffer::debugPrintToScreen("Middle mouse scroll: Zoom in/out\n");
@@ -337,16 +397,16 @@ namespace Graphics
                 bIsRunning = false;
             }
 
-            // Load our mesh
+            // Start loading a new mesh in the background
             if (O_DOWN)
             {
-                if (!loadModel())
-                {
-                    continue;
-                }
                 O_DOWN = false;
+                loadModel();
             }
 
+            // Swap in a finished mesh, or report progress while the current one keeps drawing
+            updateLoadJob();
+
             // Arcball rotation
             if (MOUSE_DOWN)
             {
@@ -358,12 +418,118 @@ namespace Graphics
                 SetCursor(cursor);
             }
 
-            // Bind vertex and index buffers to the Framebuffer
-            auto tris = m_staticMesh->getMesh()->getTris();
-            m_buffer->bindTriangleBuffer(tris);
+            // Bind vertex and index buffers to the Framebuffer. While a load is streaming in, the
+            // current model keeps drawing until the preview shows most of the new one. With
+            // nothing loaded yet, the preview is drawn as soon as the first batch arrives.
+            TriangleStream* preview = m_loadJob != nullptr ? m_loadJob->getPreview() : nullptr;
+            bool hasModel = m_staticMesh->getMesh()->numTriangles() > 0;
+            if (preview != nullptr && preview->getPublishedCount() > 0 &&
+                (!hasModel || m_loadJob->getProgress() >= PREVIEW_MIN_PROGRESS))
+            {
+                m_buffer->bindMesh(MeshView());
+                m_buffer->bindInstances({});
+                m_buffer->bindOccluder(MeshView());
+                m_buffer->bindTriangleStream(preview);
+            }
+            else
+            {
+                // Repeat the mesh across the XZ plane, one bounds width apart, sharing its streams
+                const BoundingBox& meshBounds = m_staticMesh->getMesh()->getBounds();
+                BoundingBox bounds = meshBounds;
+                m_instances.clear();
+                if (bInstanceGrid)
+                {
+                    Vector3 size = meshBounds.getSize();
+                    double spacing = std::max({size._x, size._z, 1.0}) * 1.5;
+                    double offset = (INSTANCE_GRID_SIZE - 1) * spacing * 0.5;
+                    for (int z = 0; z < INSTANCE_GRID_SIZE; z++)
+                    {
+                        for (int x = 0; x < INSTANCE_GRID_SIZE; x++)
+                        {
+                            Matrix4 instance;
+                            instance.setTranslate(Vector3(x * spacing - offset, 0.0, z * spacing - offset));
+                            m_instances.push_back(instance);
+                        }
+                    }
+
+                    bounds.expand(meshBounds.transformed(m_instances.front()));
+                    bounds.expand(meshBounds.transformed(m_instances.back()));
+                }
+
+                // Move the mesh's bounds in the spatial index; only moved nodes are recomputed
+                m_scene.setBounds(m_staticMeshNode, bounds);
+                m_scene.update();
+
+                // Pick the level for the nearest instance in view, where the world matrix places it.
+                // Simplified levels stay inside the full mesh's bounds, so the grid suits them all.
+                Camera* camera = m_buffer->getCamera();
+                const Matrix4& world = m_scene.getWorldMatrix(m_staticMeshNode);
+                size_t level = bUseLods ? m_staticMesh->selectLod(camera, m_buffer->getWidth(), m_buffer->getHeight(), world, m_instances) : 0;
+                Mesh* mesh = m_staticMesh->getLod(level).mesh;
+                m_drawnLod = level;
+                PrintBuffer::debugPrintToScreen("LOD: %i of %i, %i triangles", (int) level,
+                                                (int) m_staticMesh->getLodCount(), (int) mesh->numTriangles());
+
+                // Only objects the spatial index finds inside the view frustum reach the renderer
+                m_visibleNodes.clear();
+                m_scene.queryVisible(camera->getFrustum(m_buffer->getWidth(), m_buffer->getHeight()), m_visibleNodes);
+                bool visible = std::find(m_visibleNodes.begin(), m_visibleNodes.end(), m_staticMeshNode) != m_visibleNodes.end();
+                PrintBuffer::debugPrintToScreen("Objects: %i of %i visible", (int) m_visibleNodes.size(), (int) m_scene.numBoundedNodes());
+
+                m_buffer->bindMesh(visible ? mesh->getView() : MeshView());
+                m_buffer->bindInstances(visible ? std::span<const Matrix4>(m_instances) : std::span<const Matrix4>());
+                m_buffer->bindTriangleStream(nullptr);
+
+                // A level of detail stands in for every instance in the occlusion buffer. It is drawn
+                // shrunk by its error, so take the coarsest one that costs under an occlusion pixel.
+                const MeshLod& occluder = m_staticMesh->getLod(m_staticMesh->selectLod(camera, m_buffer->getWidth(), m_buffer->getHeight(),
+                                                                                       world, m_instances, OCCLUSION_BUFFER_SCALE));
+                m_buffer->bindOccluder(occluder.mesh->getView(), occluder.error);
+            }
+
+            // Place the mesh with its cached world matrix
+            m_scene.update();
+            m_buffer->setModelMatrix(m_scene.getWorldMatrix(m_staticMeshNode));
 
             // Draw our scene geometry as triangles
+            m_buffer->setBackfaceCulling(bCullBackfaces);
+            m_buffer->setShadingMode(bGouraud ? ShadingMode::Gouraud : ShadingMode::Flat);
+            m_buffer->setOcclusionCulling(bOcclusionCulling);
+            m_buffer->setIdChannel(bHoverIds);
+            m_buffer->setRenderMode(renderMode);
+            m_buffer->setShadowMode(shadowMode);
             m_buffer->render();
+            PrintBuffer::debugPrintToScreen("Drawn by: %s", m_buffer->isRayTraced() ? "ray tracing" : "rasterization");
+            if (shadowMode == ShadowMode::Mapped)
+            {
+                PrintBuffer::debugPrintToScreen("Shadow map: %s", m_buffer->wasShadowMapRedrawn() ? "redrawn" : "cached");
+            }
+
+            // The ID channel answers hover queries with a single read
+            if (bHoverIds)
+            {
+                PixelId hovered = m_buffer->pick(m_mousePos.x, m_mousePos.y);
+                if (hovered.isValid())
+                {
+                    PrintBuffer::debugPrintToScreen("Hover: instance %i, triangle %i", (int) hovered.object, (int) hovered.triangle);
+                }
+            }
+            if (bInstanceGrid)
+            {
+                PrintBuffer::debugPrintToScreen("Occluded: %i of %i instances", m_buffer->getOccludedCount(), (int) m_instances.size());
+            }
+
+            // Pick against the matrices this frame was drawn with
+            if (MOUSE_CLICKED)
+            {
+                MOUSE_CLICKED = false;
+                pick(m_mouseClickPos.x, m_mouseClickPos.y);
+            }
+            if (m_pickedTriangle != BVH_NO_HIT)
+            {
+                PrintBuffer::debugPrintToScreen("Picked: instance %i, triangle %i (%.1f us)", m_pickedInstance,
+                                                (int) m_pickedTriangle, m_pickTime);
+            }
 
             // Push our current RGB buffer to the display buffer
             m_buffer->allocateDisplayPtr();
@@ -417,28 +583,130 @@ namespace Graphics
 
     bool Application::loadModel()
     {
+        // Only one load runs at a time
+        if (m_loadJob != nullptr)
+        {
+            return false;
+        }
+
         std::string filename;
 
-        if (!getOpenFilename(FileTypes::Obj, filename))
+        if (!getOpenFilename(FileTypes::Model, filename))
         {
             return false;
         }
 
         std::cout << "Loading file..." << std::endl;
-        Mesh* mesh = loadObjFile(filename);
-        std::cout << "File loaded." << std::endl;
-        std::cout << mesh->numVertices() << std::endl;
-
-        m_staticMesh->setMesh(mesh);
+        LoadOptions options;
+        options.optimize = bOptimizeMeshes;
+        m_loadJob = new LoadJob(filename, options);
 
         return true;
     }
 
+    void Application::updateLoadJob()
+    {
+        if (m_loadJob == nullptr)
+        {
+            return;
+        }
+
+        if (!m_loadJob->isFinished())
+        {
+            PrintBuffer::debugPrintToScreen("Loading %s: %i%%", m_loadJob->getFilename().c_str(),
+                                            (int) (m_loadJob->getProgress() * 100.0));
+            return;
+        }
+
+        if (m_loadJob->hasError())
+        {
+            std::cout << "Failed to load file: " << m_loadJob->getError() << std::endl;
+        }
+        else
+        {
+            // Nothing is drawing the old mesh between frames, so it can be freed right away
+            Mesh* mesh = m_loadJob->takeMesh();
+            m_staticMesh->setMesh(mesh);
+
+            std::cout << "File loaded." << std::endl;
+            std::cout << mesh->numVertices() << std::endl;
+        }
+
+        delete m_loadJob;
+        m_loadJob = nullptr;
+    }
+
     bool Application::loadShader()
     {
         return true;
     }
 
+    void Application::pick(int x, int y)
+    {
+        m_pickedInstance = -1;
+        m_pickedTriangle = BVH_NO_HIT;
+        if (m_buffer == nullptr || m_staticMesh->getMesh() == nullptr)
+        {
+            return;
+        }
+
+        // Pick the level that was drawn, so the result matches what is on screen and what the
+        // ID channel reports; its triangles map back to the full mesh's
+        Mesh* mesh = m_staticMesh->getLod(std::min(m_drawnLod, m_staticMesh->getLodCount() - 1)).mesh;
+        if (mesh->getBvh().empty())
+        {
+            mesh = m_staticMesh->getMesh();
+        }
+        if (mesh->getBvh().empty())
+        {
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Ray worldRay = m_buffer->screenToRay(x, y);
+
+        // Only instances whose world bounds the ray passes through are candidates, nearest first
+        Matrix4 world = m_scene.getWorldMatrix(m_staticMeshNode);
+        size_t count = m_instances.empty() ? 1 : m_instances.size();
+        m_pickCandidates.clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            Matrix4 model = m_instances.empty() ? world : world * m_instances[i];
+            double enter = 0.0;
+            if (worldRay.intersects(mesh->getBounds().transformed(model), enter))
+            {
+                m_pickCandidates.push_back({ enter, i });
+            }
+        }
+        std::sort(m_pickCandidates.begin(), m_pickCandidates.end());
+
+        // Test the ray against each candidate in its own space; distances along it stay
+        // comparable, so candidates entered beyond the closest hit so far are skipped
+        RayHit hit;
+        for (const auto& [enter, i] : m_pickCandidates)
+        {
+            if (enter > hit.t)
+            {
+                break;
+            }
+
+            Matrix4 model = m_instances.empty() ? world : world * m_instances[i];
+            double determinant = 0.0;
+            Matrix4 inverse = model.getInverse(&determinant);
+            if (determinant == 0.0)
+            {
+                continue;
+            }
+
+            if (mesh->getBvh().intersect(worldRay.transformed(inverse), hit))
+            {
+                m_pickedInstance = (int) i;
+            }
+        }
+        m_pickedTriangle = hit.triangle != BVH_NO_HIT ? mesh->getView().getSourceTriangle(hit.triangle) : BVH_NO_HIT;
+        m_pickTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
     void Application::onMouseDown()
     {
         if (m_buffer == nullptr)
@@ -481,6 +749,7 @@ namespace Graphics
             Vector3 t = rx * ry * d * length;
 
             m_buffer->getCamera()->setTranslation(t);
+            m_scene.markDirty(m_cameraNode);
         }
     }
 
@@ -512,6 +781,7 @@ namespace Graphics
 
         // Set the new position of the camera
         m_buffer->getCamera()->setTranslation(newPosition);
+        m_scene.markDirty(m_cameraNode);
     }
 
     Application* Application::instance = nullptr;
@@ -4,9 +4,12 @@
 #include <Windows.h>
 #include <windowsx.h>
 #include <string>
+#include <vector>
 
 #include "framebuffer.h"
 #include "fileloader.h"
+#include "loadjob.h"
+#include "scene.h"
 #include "staticmesh.h"
 
 namespace Graphics {
@@ -30,6 +33,20 @@ class Application
     double m_deltaTime = 0.0;
 
     StaticMesh* m_staticMesh = new StaticMesh();
+    LoadJob* m_loadJob = nullptr;
+    std::vector<Matrix4> m_instances;
+    size_t m_drawnLod = 0;                  // Level of detail of the mesh last bound for drawing
+
+    Scene m_scene;
+    SceneNodeId m_cameraNode = SCENE_NO_NODE;
+    SceneNodeId m_staticMeshNode = SCENE_NO_NODE;
+    std::vector<SceneNodeId> m_visibleNodes;
+
+    // Result of the last click
+    int m_pickedInstance = -1;
+    uint32 m_pickedTriangle = BVH_NO_HIT;
+    double m_pickTime = 0.0;                // Microseconds
+    std::vector<std::pair<double, size_t>> m_pickCandidates;   // Entry distance and instance
 
 public:
     static Application* getAppInstance();
@@ -63,8 +80,14 @@ protected:
 
 private:
     bool loadModel();
+    void updateLoadJob();
     bool loadShader();
 
+    /// <summary>
+    /// Finds the instance and triangle of the loaded mesh under the given pixel, using its BVH.
+    /// </summary>
+    void pick(int x, int y);
+
     void onMouseDown();
     void onMouseMove();
     void onMouseScroll();
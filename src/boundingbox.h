@@ -0,0 +1,100 @@
+#ifndef BOUNDINGBOX_H
+#define BOUNDINGBOX_H
+
+#include <algorithm>
+#include <cfloat>
+
+#include "matrix.h"
+#include "vector.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+/// <summary>
+/// Axis-aligned bounding box. A default constructed box is empty (min > max) and grows
+/// to fit every point passed to expand().
+/// </summary>
+class BoundingBox
+{
+public:
+	BoundingBox()
+		: m_min(DBL_MAX), m_max(-DBL_MAX) { };
+	BoundingBox(const Vector3& min, const Vector3& max)
+		: m_min(min), m_max(max) { };
+
+	const Vector3& getMin() const { return m_min; }
+	const Vector3& getMax() const { return m_max; }
+
+	bool isEmpty() const
+	{
+		return m_min._x > m_max._x || m_min._y > m_max._y || m_min._z > m_max._z;
+	}
+
+	Vector3 getCenter() const { return (m_min + m_max) * 0.5; }
+	Vector3 getSize() const { return m_max - m_min; }
+
+	double getSurfaceArea() const
+	{
+		Vector3 size = getSize();
+		return 2.0 * (size._x * size._y + size._y * size._z + size._z * size._x);
+	}
+
+	bool contains(const BoundingBox& b) const
+	{
+		return b.m_min._x >= m_min._x && b.m_min._y >= m_min._y && b.m_min._z >= m_min._z &&
+			   b.m_max._x <= m_max._x && b.m_max._y <= m_max._y && b.m_max._z <= m_max._z;
+	}
+
+	bool operator == (const BoundingBox& b) const { return m_min == b.m_min && m_max == b.m_max; }
+	bool operator != (const BoundingBox& b) const { return !(*this == b); }
+
+	/// <summary>
+	/// Grows the box to contain the given point.
+	/// </summary>
+	void expand(const Vector3& p)
+	{
+		m_min.set(std::min(m_min._x, p._x), std::min(m_min._y, p._y), std::min(m_min._z, p._z));
+		m_max.set(std::max(m_max._x, p._x), std::max(m_max._y, p._y), std::max(m_max._z, p._z));
+	}
+
+	/// <summary>
+	/// Grows the box to contain the given box.
+	/// </summary>
+	void expand(const BoundingBox& b)
+	{
+		if (!b.isEmpty())
+		{
+			expand(b.m_min);
+			expand(b.m_max);
+		}
+	}
+
+	/// <summary>
+	/// Returns the box around this box after an affine transform. It is the tightest axis-aligned
+	/// box around the transformed corners.
+	/// </summary>
+	BoundingBox transformed(const Matrix4& m) const
+	{
+		if (isEmpty())
+		{
+			return *this;
+		}
+
+		Vector3 center = getCenter();
+		Vector3 extent = getSize() * 0.5;
+		Vector4 newCenter = m * Vector4(center, 1.0);
+		Vector3 newExtent(std::abs(m[0][0]) * extent._x + std::abs(m[0][1]) * extent._y + std::abs(m[0][2]) * extent._z,
+						  std::abs(m[1][0]) * extent._x + std::abs(m[1][1]) * extent._y + std::abs(m[1][2]) * extent._z,
+						  std::abs(m[2][0]) * extent._x + std::abs(m[2][1]) * extent._y + std::abs(m[2][2]) * extent._z);
+		Vector3 c(newCenter._x, newCenter._y, newCenter._z);
+		return BoundingBox(c - newExtent, c + newExtent);
+	}
+
+private:
+	Vector3 m_min;
+	Vector3 m_max;
+};
+
+}
+
+#endif
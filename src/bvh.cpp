@@ -0,0 +1,599 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+#include "bvh.h"
+#include "parallel.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+/// <summary>
+/// Scratch state of one build. Nodes are preallocated for the worst case, 2n - 1, and handed out
+/// in sibling pairs from an atomic counter so subtrees can be built on separate threads.
+/// </summary>
+struct Bvh::Builder
+{
+    Bvh& bvh;
+    std::vector<float> bounds;          // Six floats per triangle, min x, y, z then max x, y, z
+    std::vector<float> centroids;       // Three floats per triangle
+    std::atomic<uint32> nodeCount = 1;
+    size_t parallelDepth = 0;           // Subtrees above this depth are split across threads
+
+    Builder(Bvh& bvh) : bvh(bvh) {};
+
+    void split(uint32 nodeIndex, size_t depth);
+};
+
+struct BvhBin
+{
+    float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    uint32 count = 0;
+
+    void expand(const float* box)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            min[i] = std::min(min[i], box[i]);
+            max[i] = std::max(max[i], box[i + 3]);
+        }
+    }
+    void expand(const BvhBin& bin)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            min[i] = std::min(min[i], bin.min[i]);
+            max[i] = std::max(max[i], bin.max[i]);
+        }
+        count += bin.count;
+    }
+    double getSurfaceArea() const
+    {
+        if (count == 0)
+        {
+            return 0.0;
+        }
+        double x = max[0] - min[0];
+        double y = max[1] - min[1];
+        double z = max[2] - min[2];
+        return 2.0 * (x * y + y * z + z * x);
+    }
+};
+
+void Bvh::Builder::split(uint32 nodeIndex, size_t depth)
+{
+    Node& node = bvh.m_nodes[nodeIndex];
+    uint32 first = node.first;
+    uint32 count = node.count;
+
+    // Bounds of the triangles, and of their centroids, which is what the bins divide
+    BvhBin nodeBounds;
+    float centroidMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float centroidMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (uint32 i = first; i < first + count; i++)
+    {
+        uint32 triangle = bvh.m_triangles[i];
+        nodeBounds.expand(&bounds[(size_t) triangle * 6]);
+        const float* c = &centroids[(size_t) triangle * 3];
+        for (int a = 0; a < 3; a++)
+        {
+            centroidMin[a] = std::min(centroidMin[a], c[a]);
+            centroidMax[a] = std::max(centroidMax[a], c[a]);
+        }
+    }
+    nodeBounds.count = count;
+    std::copy_n(nodeBounds.min, 3, node.min);
+    std::copy_n(nodeBounds.max, 3, node.max);
+
+    if (count <= BVH_MAX_LEAF_TRIANGLES || depth + 1 >= BVH_MAX_DEPTH)
+    {
+        return;
+    }
+
+    // Find the cheapest bin boundary on any axis
+    int bestAxis = -1;
+    int bestBin = 0;
+    double bestCost = DBL_MAX;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0.0)
+        {
+            continue;
+        }
+
+        BvhBin bins[BVH_BIN_COUNT];
+        double scale = BVH_BIN_COUNT / extent;
+        for (uint32 i = first; i < first + count; i++)
+        {
+            uint32 triangle = bvh.m_triangles[i];
+            int bin = std::min((int) ((centroids[(size_t) triangle * 3 + axis] - centroidMin[axis]) * scale), BVH_BIN_COUNT - 1);
+            bins[bin].expand(&bounds[(size_t) triangle * 6]);
+            bins[bin].count++;
+        }
+
+        // Sweep from the right to get the cost of everything above each boundary, then from the left
+        double rightCost[BVH_BIN_COUNT];
+        BvhBin right;
+        for (int bin = BVH_BIN_COUNT - 1; bin > 0; bin--)
+        {
+            right.expand(bins[bin]);
+            rightCost[bin] = right.getSurfaceArea() * right.count;
+        }
+        BvhBin left;
+        for (int bin = 1; bin < BVH_BIN_COUNT; bin++)
+        {
+            left.expand(bins[bin - 1]);
+            if (left.count == 0 || left.count == count)
+            {
+                continue;
+            }
+
+            double cost = left.getSurfaceArea() * left.count + rightCost[bin];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = bin;
+            }
+        }
+    }
+
+    // Splitting costs one traversal step plus the triangles of each child weighted by how likely a
+    // ray through this node is to enter it; a leaf costs its triangles
+    double area = nodeBounds.getSurfaceArea();
+    double splitCost = area > 0.0 ? 1.0 + bestCost / area : DBL_MAX;
+    uint32 middle = first + count / 2;
+    if (bestAxis >= 0 && (splitCost < count || count > BVH_FORCED_LEAF_TRIANGLES))
+    {
+        double scale = BVH_BIN_COUNT / (double) (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        uint32* begin = &bvh.m_triangles[first];
+        uint32* split = std::partition(begin, begin + count, [&](uint32 triangle)
+        {
+            int bin = std::min((int) ((centroids[(size_t) triangle * 3 + bestAxis] - centroidMin[bestAxis]) * scale), BVH_BIN_COUNT - 1);
+            return bin < bestBin;
+        });
+        middle = first + (uint32) (split - begin);
+    }
+    else if (count <= BVH_FORCED_LEAF_TRIANGLES)
+    {
+        return;
+    }
+    // Otherwise every centroid is in the same place; halve the triangles as they are
+
+    uint32 children = nodeCount.fetch_add(2);
+    bvh.m_nodes[children].first = first;
+    bvh.m_nodes[children].count = middle - first;
+    bvh.m_nodes[children + 1].first = middle;
+    bvh.m_nodes[children + 1].count = first + count - middle;
+    node.first = children;
+    node.count = 0;
+
+    if (count >= BVH_PARALLEL_MIN_TRIANGLES && depth < parallelDepth)
+    {
+        std::thread thread([&]() { split(children, depth + 1); });
+        split(children + 1, depth + 1);
+        thread.join();
+    }
+    else
+    {
+        split(children, depth + 1);
+        split(children + 1, depth + 1);
+    }
+}
+
+void Bvh::build(std::span<const float> positions, std::span<const uint32> indices)
+{
+    clear();
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    Builder builder(*this);
+    builder.bounds.resize(triangleCount * 6);
+    builder.centroids.resize(triangleCount * 3);
+    m_triangles.resize(triangleCount);
+    parallelFor(triangleCount, BVH_PARALLEL_MIN_TRIANGLES, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            float* box = &builder.bounds[i * 6];
+            std::fill_n(box, 3, FLT_MAX);
+            std::fill_n(box + 3, 3, -FLT_MAX);
+            for (int corner = 0; corner < 3; corner++)
+            {
+                const float* p = &positions[(size_t) indices[i * 3 + corner] * 3];
+                for (int a = 0; a < 3; a++)
+                {
+                    box[a] = std::min(box[a], p[a]);
+                    box[a + 3] = std::max(box[a + 3], p[a]);
+                }
+            }
+            for (int a = 0; a < 3; a++)
+            {
+                builder.centroids[i * 3 + a] = (box[a] + box[a + 3]) * 0.5f;
+            }
+            m_triangles[i] = (uint32) i;
+        }
+    });
+
+    // One level of threads per doubling of the core count
+    while (((size_t) 1 << builder.parallelDepth) < getThreadCount())
+    {
+        builder.parallelDepth++;
+    }
+
+    m_nodes.resize(triangleCount * 2 - 1);
+    m_nodes[0].first = 0;
+    m_nodes[0].count = (uint32) triangleCount;
+    builder.split(0, 0);
+    m_nodes.resize(builder.nodeCount);
+    m_nodes.shrink_to_fit();
+
+    // Copy the corners into leaf order, so leaves read them contiguously
+    m_corners.resize(triangleCount * 9);
+    parallelFor(triangleCount, BVH_PARALLEL_MIN_TRIANGLES, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            for (int corner = 0; corner < 3; corner++)
+            {
+                std::copy_n(&positions[(size_t) indices[(size_t) m_triangles[i] * 3 + corner] * 3], 3, &m_corners[i * 9 + corner * 3]);
+            }
+        }
+    });
+}
+
+void Bvh::clear()
+{
+    m_nodes.clear();
+    m_triangles.clear();
+    m_corners.clear();
+}
+
+bool Bvh::assign(std::vector<Node>&& nodes, std::vector<uint32>&& triangles, std::vector<float>&& corners, size_t meshTriangles)
+{
+    clear();
+    if (nodes.empty() || corners.size() != triangles.size() * 9)
+    {
+        return false;
+    }
+
+    for (uint32 triangle : triangles)
+    {
+        if (triangle >= meshTriangles)
+        {
+            return false;
+        }
+    }
+
+    // Builds always place children after their parent, which rules out cycles, and give every
+    // node a single parent, so its depth is known before it is reached. The depth must fit the
+    // traversal stack.
+    std::vector<size_t> depths(nodes.size(), 0);
+    std::vector<bool> seen(nodes.size(), false);
+    seen[0] = true;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        const Node& node = nodes[i];
+        if (node.isLeaf())
+        {
+            if (node.first > triangles.size() || node.count > triangles.size() - node.first)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            if (node.first <= i || node.first >= nodes.size() - 1 || depths[i] + 1 >= BVH_MAX_DEPTH ||
+                seen[node.first] || seen[node.first + 1])
+            {
+                return false;
+            }
+            for (size_t child = node.first; child <= node.first + 1; child++)
+            {
+                seen[child] = true;
+                depths[child] = depths[i] + 1;
+            }
+        }
+    }
+
+    m_nodes = std::move(nodes);
+    m_triangles = std::move(triangles);
+    m_corners = std::move(corners);
+    return true;
+}
+
+BoundingBox Bvh::getBounds() const
+{
+    if (m_nodes.empty())
+    {
+        return BoundingBox();
+    }
+    const Node& root = m_nodes[0];
+    return BoundingBox(Vector3(root.min[0], root.min[1], root.min[2]), Vector3(root.max[0], root.max[1], root.max[2]));
+}
+
+/// <summary>
+/// Ray data in the form the traversal loops use.
+/// </summary>
+struct BvhRay
+{
+    double origin[3];
+    double direction[3];
+    double inverse[3];
+
+    BvhRay() {};
+    BvhRay(const Ray& ray)
+    {
+        origin[0] = ray.origin._x;
+        origin[1] = ray.origin._y;
+        origin[2] = ray.origin._z;
+        direction[0] = ray.direction._x;
+        direction[1] = ray.direction._y;
+        direction[2] = ray.direction._z;
+        for (int a = 0; a < 3; a++)
+        {
+            inverse[a] = 1.0 / direction[a];
+        }
+    }
+
+    /// <summary>
+    /// Returns where the ray enters the box, or DBL_MAX if it misses it within [tMin, tMax].
+    /// </summary>
+    double enter(const float* min, const float* max, double tMin, double tMax) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            double t1 = (min[a] - origin[a]) * inverse[a];
+            double t2 = (max[a] - origin[a]) * inverse[a];
+            tMin = std::max(tMin, std::min(t1, t2));
+            tMax = std::min(tMax, std::max(t1, t2));
+        }
+        return tMin <= tMax ? tMin : DBL_MAX;
+    }
+
+    /// <summary>
+    /// Intersects a triangle given as nine floats (Moller and Trumbore).
+    /// </summary>
+    bool intersect(const float* c, double tMin, double tMax, double& t, double& u, double& v) const
+    {
+        double e1[3] = { (double) c[3] - c[0], (double) c[4] - c[1], (double) c[5] - c[2] };
+        double e2[3] = { (double) c[6] - c[0], (double) c[7] - c[1], (double) c[8] - c[2] };
+        double p[3] = { direction[1] * e2[2] - direction[2] * e2[1],
+                        direction[2] * e2[0] - direction[0] * e2[2],
+                        direction[0] * e2[1] - direction[1] * e2[0] };
+        double determinant = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+        if (determinant == 0.0)
+        {
+            return false;
+        }
+
+        double inverseDeterminant = 1.0 / determinant;
+        double s[3] = { origin[0] - c[0], origin[1] - c[1], origin[2] - c[2] };
+        u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDeterminant;
+        if (u < 0.0 || u > 1.0)
+        {
+            return false;
+        }
+
+        double q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+        v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * inverseDeterminant;
+        if (v < 0.0 || u + v > 1.0)
+        {
+            return false;
+        }
+
+        t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverseDeterminant;
+        return t >= tMin && t <= tMax;
+    }
+};
+
+bool Bvh::intersect(const Ray& ray, RayHit& hit) const
+{
+    if (m_nodes.empty())
+    {
+        return false;
+    }
+
+    BvhRay r(ray);
+    double closest = std::min(ray.tMax, hit.t);
+    bool found = false;
+
+    uint32 stack[BVH_MAX_DEPTH];
+    size_t size = 0;
+    if (r.enter(m_nodes[0].min, m_nodes[0].max, ray.tMin, closest) == DBL_MAX)
+    {
+        return false;
+    }
+    stack[size++] = 0;
+
+    while (size > 0)
+    {
+        const Node& node = m_nodes[stack[--size]];
+        if (node.isLeaf())
+        {
+            for (uint32 i = node.first; i < node.first + node.count; i++)
+            {
+                double t, u, v;
+                if (r.intersect(&m_corners[(size_t) i * 9], ray.tMin, closest, t, u, v))
+                {
+                    closest = t;
+                    hit.t = t;
+                    hit.u = u;
+                    hit.v = v;
+                    hit.triangle = m_triangles[i];
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first, so the further one is more often skipped
+        const Node& left = m_nodes[node.first];
+        const Node& right = m_nodes[node.first + 1];
+        double leftT = r.enter(left.min, left.max, ray.tMin, closest);
+        double rightT = r.enter(right.min, right.max, ray.tMin, closest);
+        uint32 near = node.first;
+        uint32 far = node.first + 1;
+        if (rightT < leftT)
+        {
+            std::swap(leftT, rightT);
+            std::swap(near, far);
+        }
+        if (rightT != DBL_MAX)
+        {
+            stack[size++] = far;
+        }
+        if (leftT != DBL_MAX)
+        {
+            stack[size++] = near;
+        }
+    }
+
+    return found;
+}
+
+void Bvh::intersect(RayPacket& packet) const
+{
+    if (m_nodes.empty() || packet.count == 0)
+    {
+        return;
+    }
+
+    // Rays past the count get an empty range, so they never enter anything
+    constexpr size_t N = RAY_PACKET_SIZE;
+    double originX[N], originY[N], originZ[N];
+    double inverseX[N], inverseY[N], inverseZ[N];
+    double tMin[N], tMax[N];
+    BvhRay rays[N];
+    for (size_t i = 0; i < N; i++)
+    {
+        const Ray& ray = packet.rays[std::min(i, packet.count - 1)];
+        rays[i] = BvhRay(ray);
+        originX[i] = ray.origin._x;
+        originY[i] = ray.origin._y;
+        originZ[i] = ray.origin._z;
+        inverseX[i] = 1.0 / ray.direction._x;
+        inverseY[i] = 1.0 / ray.direction._y;
+        inverseZ[i] = 1.0 / ray.direction._z;
+        tMin[i] = i < packet.count ? ray.tMin : 1.0;
+        tMax[i] = i < packet.count ? std::min(ray.tMax, packet.hits[i].t) : 0.0;
+    }
+
+    // Returns the nearest entry of any ray into the node, or DBL_MAX if none enters it
+    auto enter = [&](const Node& node)
+    {
+        double nearest = DBL_MAX;
+        for (size_t i = 0; i < N; i++)
+        {
+            double x1 = (node.min[0] - originX[i]) * inverseX[i];
+            double x2 = (node.max[0] - originX[i]) * inverseX[i];
+            double y1 = (node.min[1] - originY[i]) * inverseY[i];
+            double y2 = (node.max[1] - originY[i]) * inverseY[i];
+            double z1 = (node.min[2] - originZ[i]) * inverseZ[i];
+            double z2 = (node.max[2] - originZ[i]) * inverseZ[i];
+            double entry = std::max({ tMin[i], std::min(x1, x2), std::min(y1, y2), std::min(z1, z2) });
+            double exit = std::min({ tMax[i], std::max(x1, x2), std::max(y1, y2), std::max(z1, z2) });
+            nearest = entry <= exit ? std::min(nearest, entry) : nearest;
+        }
+        return nearest;
+    };
+
+    uint32 stack[BVH_MAX_DEPTH];
+    size_t size = 0;
+    if (enter(m_nodes[0]) == DBL_MAX)
+    {
+        return;
+    }
+    stack[size++] = 0;
+
+    while (size > 0)
+    {
+        const Node& node = m_nodes[stack[--size]];
+        if (node.isLeaf())
+        {
+            for (uint32 j = node.first; j < node.first + node.count; j++)
+            {
+                const float* corners = &m_corners[(size_t) j * 9];
+                for (size_t i = 0; i < packet.count; i++)
+                {
+                    double t, u, v;
+                    if (rays[i].intersect(corners, tMin[i], tMax[i], t, u, v))
+                    {
+                        tMax[i] = t;
+                        packet.hits[i].t = t;
+                        packet.hits[i].u = u;
+                        packet.hits[i].v = v;
+                        packet.hits[i].triangle = m_triangles[j];
+                    }
+                }
+            }
+            continue;
+        }
+
+        uint32 near = node.first;
+        uint32 far = node.first + 1;
+        double nearT = enter(m_nodes[near]);
+        double farT = enter(m_nodes[far]);
+        if (farT < nearT)
+        {
+            std::swap(nearT, farT);
+            std::swap(near, far);
+        }
+        if (farT != DBL_MAX)
+        {
+            stack[size++] = far;
+        }
+        if (nearT != DBL_MAX)
+        {
+            stack[size++] = near;
+        }
+    }
+}
+
+bool Bvh::occluded(const Ray& ray) const
+{
+    if (m_nodes.empty())
+    {
+        return false;
+    }
+
+    BvhRay r(ray);
+    uint32 stack[BVH_MAX_DEPTH];
+    size_t size = 0;
+    stack[size++] = 0;
+
+    while (size > 0)
+    {
+        const Node& node = m_nodes[stack[--size]];
+        if (r.enter(node.min, node.max, ray.tMin, ray.tMax) == DBL_MAX)
+        {
+            continue;
+        }
+
+        if (node.isLeaf())
+        {
+            for (uint32 i = node.first; i < node.first + node.count; i++)
+            {
+                double t, u, v;
+                if (r.intersect(&m_corners[(size_t) i * 9], ray.tMin, ray.tMax, t, u, v))
+                {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        stack[size++] = node.first + 1;
+        stack[size++] = node.first;
+    }
+
+    return false;
+}
+
+}
@@ -0,0 +1,190 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cfloat>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "api.h"
+#include "boundingbox.h"
+#include "matrix.h"
+#include "vector.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+constexpr uint32 BVH_NO_HIT = UINT32_MAX;
+constexpr size_t BVH_MAX_LEAF_TRIANGLES = 4;		// Leaves this small are never split further
+constexpr size_t BVH_FORCED_LEAF_TRIANGLES = 16;	// Larger leaves are split even when SAH says not to
+constexpr int BVH_BIN_COUNT = 16;					// Candidate split planes per axis
+constexpr size_t BVH_PARALLEL_MIN_TRIANGLES = 1 << 15;	// Smallest subtree worth building on its own thread
+constexpr size_t BVH_MAX_DEPTH = 64;				// Traversal stack size; builds stop splitting below this
+constexpr size_t RAY_PACKET_SIZE = 4;				// Rays traced together, a 2x2 block of pixels
+
+/// <summary>
+/// A half-line through space. Hits are only reported between tMin and tMax along the direction,
+/// which does not need to be unit length.
+/// </summary>
+struct Ray
+{
+	Vector3 origin;
+	Vector3 direction;
+	double tMin = 0.0;
+	double tMax = DBL_MAX;
+
+	Vector3 at(double t) const { return origin + direction * t; }
+
+	/// <summary>
+	/// Returns the ray carried into the space the given affine matrix maps to. The direction is
+	/// not renormalized, so distances along the ray stay comparable between spaces.
+	/// </summary>
+	Ray transformed(const Matrix4& m) const
+	{
+		Vector4 o = m * Vector4(origin, 1.0);
+		Vector4 d = m * Vector4(direction, 0.0);
+		Ray ray = *this;
+		ray.origin = Vector3(o._x, o._y, o._z);
+		ray.direction = Vector3(d._x, d._y, d._z);
+		return ray;
+	}
+
+	/// <summary>
+	/// Returns whether the ray passes through the box between tMin and tMax, and where it enters.
+	/// </summary>
+	bool intersects(const BoundingBox& box, double& tEnter) const
+	{
+		double o[3] = { origin._x, origin._y, origin._z };
+		double d[3] = { direction._x, direction._y, direction._z };
+		double tNear = tMin;
+		double tFar = tMax;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			double inverse = 1.0 / d[axis];
+			double t0 = (box.getMin()[axis] - o[axis]) * inverse;
+			double t1 = (box.getMax()[axis] - o[axis]) * inverse;
+			if (t0 > t1)
+			{
+				std::swap(t0, t1);
+			}
+
+			// NaN, from a ray in the plane of a face, leaves the range as it was
+			tNear = t0 > tNear ? t0 : tNear;
+			tFar = t1 < tFar ? t1 : tFar;
+			if (tNear > tFar)
+			{
+				return false;
+			}
+		}
+		tEnter = tNear;
+		return true;
+	}
+};
+
+/// <summary>
+/// The closest triangle a ray hit, with the barycentric weights of the second and third corner at
+/// the hit point.
+/// </summary>
+struct RayHit
+{
+	double t = DBL_MAX;
+	uint32 triangle = BVH_NO_HIT;
+	double u = 0.0;
+	double v = 0.0;
+
+	bool isHit() const { return triangle != BVH_NO_HIT; }
+};
+
+/// <summary>
+/// Rays traced through the hierarchy together. Rays of neighbouring pixels visit nearly the same
+/// nodes, so each node is fetched once for all of them, and the per-ray loops are laid out for the
+/// compiler to vectorize. Hits already in the packet are only replaced by closer ones.
+/// </summary>
+struct RayPacket
+{
+	Ray rays[RAY_PACKET_SIZE];
+	RayHit hits[RAY_PACKET_SIZE];
+	size_t count = RAY_PACKET_SIZE;			// Rays in use, from the first
+};
+
+/// <summary>
+/// Bounding volume hierarchy over the triangles of a mesh, for ray queries. It is built top down
+/// with the surface area heuristic, evaluated over a few bins per axis, and large subtrees are
+/// built in parallel. Leaves keep their own copy of their triangles' corners, so queries don't
+/// touch the mesh and stay valid after it is freed.
+/// </summary>
+class Bvh
+{
+public:
+	// 32 bytes. Internal nodes have count 0 and their children at first and first + 1, leaves
+	// hold triangles [first, first + count) of m_triangles.
+	struct Node
+	{
+		float min[3];
+		uint32 first;
+		float max[3];
+		uint32 count;
+
+		bool isLeaf() const { return count > 0; }
+	};
+
+private:
+	std::vector<Node> m_nodes;
+	std::vector<uint32> m_triangles;		// Mesh triangle index of each leaf slot
+	std::vector<float> m_corners;			// Nine floats per leaf slot, the triangle's three corners
+
+	struct Builder;
+
+public:
+	Bvh() {};
+
+	bool empty() const { return m_nodes.empty(); }
+	size_t numNodes() const { return m_nodes.size(); }
+	size_t numTriangles() const { return m_triangles.size(); }
+
+	BoundingBox getBounds() const;
+
+	/// <summary>
+	/// Rebuilds the hierarchy over the given triangles. Anything built before is discarded.
+	/// </summary>
+	/// <param name="positions">Vertex positions, x, y, z per vertex.</param>
+	/// <param name="indices">Three vertex indices per triangle.</param>
+	void build(std::span<const float> positions, std::span<const uint32> indices);
+
+	void clear();
+
+	// The built hierarchy as flat arrays, for storing it
+	std::span<const Node> getNodes() const { return m_nodes; }
+	std::span<const uint32> getTriangles() const { return m_triangles; }
+	std::span<const float> getCorners() const { return m_corners; }
+
+	/// <summary>
+	/// Takes over a hierarchy stored from getNodes(), getTriangles() and getCorners(). Every node
+	/// is checked, so a corrupt copy can't make queries read out of bounds.
+	/// </summary>
+	/// <param name="meshTriangles">The number of triangles in the mesh it was built over.</param>
+	/// <returns>Whether the arrays form a valid hierarchy. If not, the BVH is left empty.</returns>
+	bool assign(std::vector<Node>&& nodes, std::vector<uint32>&& triangles, std::vector<float>&& corners, size_t meshTriangles);
+
+	/// <summary>
+	/// Finds the closest triangle along the ray, from either side.
+	/// </summary>
+	/// <returns>Whether anything was hit.</returns>
+	bool intersect(const Ray& ray, RayHit& hit) const;
+
+	/// <summary>
+	/// Finds the closest triangle along every ray of the packet. A node is visited when any of
+	/// the rays enters it.
+	/// </summary>
+	void intersect(RayPacket& packet) const;
+
+	/// <summary>
+	/// Returns whether the ray hits any triangle at all. It stops at the first one found, which
+	/// makes it cheaper than intersect() for visibility tests.
+	/// </summary>
+	bool occluded(const Ray& ray) const;
+};
+
+}
+
+#endif
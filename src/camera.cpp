@@ -11,7 +11,7 @@ Camera::Camera()
 // https://www.3dgep.com/understanding-the-view-matrix/
 const Matrix4 Camera::getViewMatrix()
 {
-    Matrix4 m = getTransform().getMatrix();
+    Matrix4 m = TransformStorage::get().computeMatrix(m_transform);
     return m.getInverse();
 }
 
@@ -59,4 +59,10 @@ const Matrix4 Camera::getProjectionMatrix(const double width, const double heigh
     return proj;
 }
 
+Frustum Camera::getFrustum(const double width, const double height)
+{
+    Matrix4 view = lookAt(getTranslation(), m_target, Vector3::up());
+    return Frustum(getProjectionMatrix(width, height) * view, m_farClip);
+}
+
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "frustum.h"
 #include "object.h"
 #include "maths.h"
 
@@ -25,7 +26,10 @@ public:
 	inline void	updateViewMatrix()
 	{
 		Matrix4 m = lookAt(getTranslation(), m_target, Vector3::up());
-		m_transform.setMatrix(m);
+		Transform t;
+		t.setMatrix(m);
+		setTranslation(t.getTranslation());
+		setRotation(t.getRotation());
 	}
 	inline void updateViewMatrix(Matrix4& m)
 	{
@@ -34,6 +38,12 @@ public:
 
 	const Matrix4			getProjectionMatrix(const double width, const double height);
 
+	/// <summary>
+	/// Returns the volume seen through a viewport of the given size, from the projection matrix
+	/// times the view matrix looking at the target.
+	/// </summary>
+	Frustum getFrustum(const double width, const double height);
+
 private:
 	Vector3 m_target		= Vector3(0.0);
 
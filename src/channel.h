@@ -13,6 +13,7 @@
 #define CHANNEL_NORMAL_R    "Normal_R"
 #define CHANNEL_NORMAL_G    "Normal_G"
 #define CHANNEL_NORMAL_B    "Normal_B"
+#define CHANNEL_ID          "ID"            // Optional, see Framebuffer::setIdChannel()
 
 namespace Graphics
 {
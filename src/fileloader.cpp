@@ -3,6 +3,20 @@
 namespace Graphics {
     constexpr uint32 GLTF_MAGIC = 0x46546C67;
     constexpr size_t GLTF_HEADER_SIZE = sizeof(uint32);
+    constexpr uint32 GLTF_CHUNK_JSON = 0x4E4F534A;      // 'JSON'
+    constexpr uint32 GLTF_CHUNK_BIN = 0x004E4942;       // 'BIN\0'
+    constexpr int GLTF_MODE_TRIANGLES = 4;
+    constexpr int GLTF_UNSIGNED_BYTE = 5121;
+    constexpr int GLTF_UNSIGNED_SHORT = 5123;
+    constexpr int GLTF_UNSIGNED_INT = 5125;
+    constexpr int GLTF_FLOAT = 5126;
+    constexpr size_t OBJ_CHUNK_SIZE = 1 << 20;         // Target size of the slices a file is parsed in
+    constexpr size_t OBJ_PROGRESS_INTERVAL = 1 << 20;  // Bytes parsed between progress updates
+    constexpr int OBJ_POSITION = 0;
+    constexpr int OBJ_UV = 1;
+    constexpr int OBJ_NORMAL = 2;
+    constexpr int OBJ_ATTRIBUTE_COUNT = 3;
+    constexpr int OBJ_NO_INDEX = INT_MIN;               // An attribute a face corner does not reference
 
     bool getOpenFilename(FileTypes type, std::string& filename)
     {
@@ -12,6 +26,17 @@ namespace Graphics {
         case Obj:
         {
             typeFilter = FILE_FILTER_OBJ;
+            break;
+        }
+        case Gltf:
+        {
+            typeFilter = FILE_FILTER_GLB;
+            break;
+        }
+        default:
+        {
+            typeFilter = FILE_FILTER_MODEL;
+            break;
         }
         }
 
@@ -39,40 +64,182 @@ namespace Graphics {
         }
     }
 
-    Mesh* loadGlbFile(const std::string& filename)
+    /// <summary>
+    /// Strided view of a glTF accessor. Points straight into the BIN chunk of the mapped file, so
+    /// resolving an accessor never copies its elements.
+    /// </summary>
+    struct GltfAccessor
     {
-        Mesh* mesh = new Mesh();
-        std::vector<Vertex> vertices;	// Empty vertex array
-        std::vector<int> indices;		// Empty index array
-        std::vector<Vector3> normals;
+        const char* data = nullptr;
+        size_t count = 0;
+        size_t stride = 0;
+        int componentType = 0;
+        int components = 0;
 
-        /// Open file
-        std::ifstream file(filename, std::ios::binary);	// Read as binary file
-        if (!file)
+        /// <summary>
+        /// Copies every element of a float accessor to the given tightly packed array. Packed
+        /// accessors are copied in one go, interleaved ones an element at a time.
+        /// </summary>
+        void copyFloats(float* out) const
         {
-            throw std::runtime_error("Failed to read file.");
+            size_t elementSize = components * sizeof(float);
+            if (stride == elementSize)
+            {
+                memcpy(out, data, count * elementSize);
+                return;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                memcpy(out + i * components, data + i * stride, elementSize);
+            }
+        }
+
+        uint32 getIndex(size_t element) const
+        {
+            const char* ptr = data + element * stride;
+            switch (componentType)
+            {
+            case GLTF_UNSIGNED_BYTE:
+                return *reinterpret_cast<const uint8*>(ptr);
+            case GLTF_UNSIGNED_SHORT:
+            {
+                uint16 value;
+                memcpy(&value, ptr, sizeof(uint16));
+                return value;
+            }
+            default:
+            {
+                uint32 value;
+                memcpy(&value, ptr, sizeof(uint32));
+                return value;
+            }
+            }
+        }
+    };
+
+    static int getGltfComponentSize(int componentType)
+    {
+        switch (componentType)
+        {
+        case GLTF_UNSIGNED_BYTE:
+            return 1;
+        case GLTF_UNSIGNED_SHORT:
+            return 2;
+        case GLTF_UNSIGNED_INT:
+        case GLTF_FLOAT:
+            return 4;
+        default:
+            throw std::runtime_error("Unsupported accessor component type.");
+        }
+    }
+
+    static int getGltfComponentCount(std::string_view type)
+    {
+        if (type == "SCALAR")
+        {
+            return 1;
+        }
+        if (type == "VEC2")
+        {
+            return 2;
+        }
+        if (type == "VEC3")
+        {
+            return 3;
+        }
+        if (type == "VEC4")
+        {
+            return 4;
         }
+        throw std::runtime_error("Unsupported accessor type.");
+    }
+
+    /// <summary>
+    /// Reads a byte count or offset, which must be a whole number between 0 and the limit.
+    /// </summary>
+    static size_t getGltfSize(JSON::JsonValue value, double fallback, size_t limit, const char* name)
+    {
+        double number = value.asNumber(fallback);
+        if (!std::isfinite(number) || number < 0.0 || number != std::floor(number) || number > (double) limit)
+        {
+            throw std::runtime_error(std::string("Invalid ") + name + ".");
+        }
+        return (size_t) number;
+    }
 
-        // Get file size
-        file.seekg(0, std::ios::end);				// Move to end
-        std::streamsize fileSize = file.tellg();	// Get byte position at this point
-        std::vector<char> buffer(fileSize);			// Construct new char buffer
-        file.seekg(0, std::ios::beg);				// Move back to beginning
-        file.read(&buffer.at(0), fileSize);			// Read all contents into memory into the address at the
-                                                    // beginning of the buffer
-        file.close();								// Close the file
+    /// <summary>
+    /// Resolves the accessor at the given index through its buffer view into the BIN chunk.
+    /// </summary>
+    static GltfAccessor getGltfAccessor(JSON::JsonValue gltf, int index, const char* bin, size_t binSize)
+    {
+        JSON::JsonValue accessor = gltf["accessors"][index];
+        JSON::JsonValue bufferView = gltf["bufferViews"][accessor["bufferView"].asInt(-1)];
+        if (!accessor.isObject() || !bufferView.isObject())
+        {
+            throw std::runtime_error("Invalid accessor " + std::to_string(index) + ".");
+        }
+        if (bufferView["buffer"].asInt() != 0)
+        {
+            throw std::runtime_error("Only the embedded GLB buffer is supported.");
+        }
 
-        // Convert file memory into unsigned char pointer
-        auto* bytes = reinterpret_cast<unsigned char*>(&buffer.at(0));
+        GltfAccessor result;
+        result.componentType = accessor["componentType"].asInt();
+        result.components = getGltfComponentCount(accessor["type"].asString());
+        size_t elementSize = (size_t) getGltfComponentSize(result.componentType) * result.components;
+
+        // Every field is checked against what is left of the BIN chunk before it is used, so none
+        // of the sums below can wrap
+        size_t viewOffset = getGltfSize(bufferView["byteOffset"], 0.0, binSize, "buffer view offset");
+        size_t viewLength = getGltfSize(bufferView["byteLength"], -1.0, binSize - viewOffset, "buffer view length");
+        size_t offset = getGltfSize(accessor["byteOffset"], 0.0, viewLength, "accessor offset");
+        result.count = getGltfSize(accessor["count"], -1.0, binSize, "accessor count");
+        result.stride = getGltfSize(bufferView["byteStride"], (double) elementSize, binSize, "buffer view stride");
+        if (result.stride < elementSize)
+        {
+            throw std::runtime_error("Accessor " + std::to_string(index) + " overlaps its own elements.");
+        }
+
+        // The last element must end inside the buffer view
+        size_t available = viewLength - offset;
+        if (result.count > 0 && (elementSize > available || result.count - 1 > (available - elementSize) / result.stride))
+        {
+            throw std::runtime_error("Accessor " + std::to_string(index) + " is out of bounds.");
+        }
+        offset += viewOffset;
+
+        result.data = bin + offset;
+        return result;
+    }
+
+    Mesh* loadGlbFile(const std::string& filename, LoadProgress* progress)
+    {
+        std::vector<float> positions;	// Empty vertex streams
+        std::vector<float> normals;
+        std::vector<float> uvs;
+        std::vector<uint32> indices;	// Empty index array
+        bool hasNormals = false;		// Whether any primitive had normals or UVs
+        bool hasUVs = false;
+
+        /// Open file
+        MappedFile file;
+        if (!file.open(filename))
+        {
+            throw std::runtime_error("Failed to read file.");
+        }
+        auto* bytes = reinterpret_cast<const unsigned char*>(file.data());
 
         /// Start reading the first 12-byte header
-        // Validate the magic number header at the top of the file. This should read as 'glTF', 1 byte per letter.
-        // 4 bytes total.
-        if (bytes[0] == 'g' && bytes[1] == 'l' && bytes[2] == 'T' && bytes[3] == 'F')
+        if (file.size() < GLTF_HEADER_SIZE * 5)
         {
-            // This is a valid magic header
+            throw std::runtime_error("Invalid magic header!");
         }
-        else
+
+        // Validate the magic number header at the top of the file. This should read as 'glTF', 1 byte per letter.
+        // 4 bytes total.
+        uint32 magic;
+        memcpy(&magic, bytes, GLTF_HEADER_SIZE);
+        if (magic != GLTF_MAGIC)
         {
             throw std::runtime_error("Invalid magic header!");
         }
@@ -88,185 +255,897 @@ namespace Graphics {
         // Read the length, which is the file size, and compare to the actual file size
         uint32 length;
         memcpy(&length, bytes + (GLTF_HEADER_SIZE * 2), GLTF_HEADER_SIZE);
-        if (length != fileSize)
+        if (length != file.size())
         {
             throw std::runtime_error("Invalid file size; does not match actual file size.");
         }
 
-        // Read the JSON content length
-        uint32 jsonLength;
-        memcpy(&jsonLength, bytes + (GLTF_HEADER_SIZE * 3), GLTF_HEADER_SIZE);
+        /// Walk the chunks following the header: the JSON chunk first, then the optional BIN chunk
+        std::string_view jsonString;
+        const char* bin = nullptr;
+        size_t binSize = 0;
 
-        // Extract JSON content as a string
-        std::string jsonString(reinterpret_cast<const char*>(&bytes[20]), jsonLength);
+        size_t offset = GLTF_HEADER_SIZE * 3;
+        while (offset + GLTF_HEADER_SIZE * 2 <= file.size())
+        {
+            uint32 chunkLength;
+            uint32 chunkType;
+            memcpy(&chunkLength, bytes + offset, GLTF_HEADER_SIZE);
+            memcpy(&chunkType, bytes + offset + GLTF_HEADER_SIZE, GLTF_HEADER_SIZE);
+            offset += GLTF_HEADER_SIZE * 2;
+
+            if (chunkLength > file.size() - offset)
+            {
+                throw std::runtime_error("Invalid chunk length.");
+            }
+
+            if (chunkType == GLTF_CHUNK_JSON && jsonString.empty())
+            {
+                jsonString = std::string_view(file.data() + offset, chunkLength);
+            }
+            else if (chunkType == GLTF_CHUNK_BIN && bin == nullptr)
+            {
+                bin = file.data() + offset;
+                binSize = chunkLength;
+            }
+            offset += chunkLength;
+        }
+
+        if (jsonString.empty())
+        {
+            throw std::runtime_error("Missing JSON chunk.");
+        }
 
         /// Parse JSON string
-        //JSON::JsonObject gltfJson = JSON::loadString(jsonString);
+        JSON::JsonDocument document = JSON::loadString(jsonString);
+        JSON::JsonValue gltf = document.getRoot();
+
+        /// Append every triangle primitive of every mesh
+        for (JSON::JsonValue gltfMesh : gltf["meshes"])
+        {
+            for (JSON::JsonValue primitive : gltfMesh["primitives"])
+            {
+                if (primitive["mode"].asInt(GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES)
+                {
+                    continue;
+                }
+
+                JSON::JsonValue attributes = primitive["attributes"];
+                if (!attributes.has("POSITION"))
+                {
+                    continue;
+                }
+
+                GltfAccessor primitivePositions = getGltfAccessor(gltf, attributes["POSITION"].asInt(), bin, binSize);
+                if (primitivePositions.componentType != GLTF_FLOAT || primitivePositions.components != 3)
+                {
+                    throw std::runtime_error("POSITION must be a float VEC3 accessor.");
+                }
+
+                GltfAccessor primitiveNormals;
+                if (attributes.has("NORMAL"))
+                {
+                    primitiveNormals = getGltfAccessor(gltf, attributes["NORMAL"].asInt(), bin, binSize);
+                    if (primitiveNormals.componentType != GLTF_FLOAT || primitiveNormals.components != 3 ||
+                        primitiveNormals.count != primitivePositions.count)
+                    {
+                        throw std::runtime_error("NORMAL must be a float VEC3 accessor matching POSITION.");
+                    }
+                    hasNormals = true;
+                }
+
+                GltfAccessor primitiveUVs;
+                if (attributes.has("TEXCOORD_0"))
+                {
+                    primitiveUVs = getGltfAccessor(gltf, attributes["TEXCOORD_0"].asInt(), bin, binSize);
+                    if (primitiveUVs.componentType != GLTF_FLOAT || primitiveUVs.components != 2 ||
+                        primitiveUVs.count != primitivePositions.count)
+                    {
+                        throw std::runtime_error("TEXCOORD_0 must be a float VEC2 accessor matching POSITION.");
+                    }
+                    hasUVs = true;
+                }
+
+                // Primitives missing an attribute other primitives have are padded with zeros
+                size_t baseVertex = positions.size() / 3;
+                size_t firstIndex = indices.size();
+                size_t count = primitivePositions.count;
+                positions.resize(positions.size() + count * 3);
+                normals.resize(normals.size() + count * 3, 0.0f);
+                uvs.resize(uvs.size() + count * 2, 0.0f);
+                primitivePositions.copyFloats(&positions[baseVertex * 3]);
+                if (primitiveNormals.data != nullptr)
+                {
+                    primitiveNormals.copyFloats(&normals[baseVertex * 3]);
+                }
+                if (primitiveUVs.data != nullptr)
+                {
+                    primitiveUVs.copyFloats(&uvs[baseVertex * 2]);
+                }
+
+                // Primitives without indices are drawn as a flat list of triangles
+                if (primitive.has("indices"))
+                {
+                    GltfAccessor primitiveIndices = getGltfAccessor(gltf, primitive["indices"].asInt(), bin, binSize);
+                    if (primitiveIndices.components != 1 || primitiveIndices.componentType == GLTF_FLOAT)
+                    {
+                        throw std::runtime_error("Indices must be an unsigned integer SCALAR accessor.");
+                    }
+
+                    size_t triangleIndexCount = primitiveIndices.count - primitiveIndices.count % 3;
+                    indices.reserve(indices.size() + triangleIndexCount);
+                    for (size_t i = 0; i < triangleIndexCount; i++)
+                    {
+                        uint32 index = primitiveIndices.getIndex(i);
+                        if (index >= count)
+                        {
+                            throw std::runtime_error("Face index out of range.");
+                        }
+                        indices.push_back((uint32) (baseVertex + index));
+                    }
+                }
+                else
+                {
+                    for (size_t i = 0; i + 2 < count; i += 3)
+                    {
+                        indices.push_back((uint32) (baseVertex + i));
+                        indices.push_back((uint32) (baseVertex + i + 1));
+                        indices.push_back((uint32) (baseVertex + i + 2));
+                    }
+                }
+
+                if (progress != nullptr && progress->preview != nullptr)
+                {
+                    auto getPosition = [&](uint32 index)
+                    {
+                        return Vector3(positions[index * 3], positions[index * 3 + 1], positions[index * 3 + 2]);
+                    };
+                    for (size_t i = firstIndex; i < indices.size(); i += 3)
+                    {
+                        progress->preview->append(getPosition(indices[i]),
+                                                  getPosition(indices[i + 1]),
+                                                  getPosition(indices[i + 2]));
+                    }
+                    progress->preview->publish();
+                }
+            }
+        }
+
+        if (!hasNormals)
+        {
+            normals.clear();
+        }
+        if (!hasUVs)
+        {
+            uvs.clear();
+        }
+
+        // Allocated last, so nothing thrown above can leak it
+        Mesh* mesh = new Mesh();
+        mesh->setPositions(std::move(positions));
+        mesh->setNormals(std::move(normals));
+        mesh->setUVs(std::move(uvs));
+        mesh->setIndices(std::move(indices));
+        mesh->computeFaceData();
+        mesh->computeBounds();
 
         return mesh;
     }
 
-    Mesh* loadObjFile(const std::string& filename)
+    static inline bool isBlank(char c)
     {
-        Mesh* mesh = new Mesh();
-        std::vector<Vertex> vertices;	// Empty vertex array
-        std::vector<int> indices;		// Empty index array
-        std::vector<Vector3> normals;
+        return c == ' ' || c == '\t';
+    }
 
-        std::ifstream file(filename);	// New filestream
-        if (!file)
+    static inline bool isLineEnd(char c)
+    {
+        return c == '\n' || c == '\r';
+    }
+
+    /// <summary>
+    /// Advances past spaces and tabs on the current line.
+    /// </summary>
+    static inline const char* skipBlanks(const char* ptr, const char* end)
+    {
+        while (ptr < end && isBlank(*ptr))
         {
-            throw std::runtime_error("Invalid file: " + filename);
+            ptr++;
+        }
+        return ptr;
+    }
+
+    /// <summary>
+    /// Advances past any whitespace, including line breaks and empty lines.
+    /// </summary>
+    static inline const char* skipWhitespace(const char* ptr, const char* end)
+    {
+        while (ptr < end && (isBlank(*ptr) || isLineEnd(*ptr)))
+        {
+            ptr++;
         }
-        std::stringstream stream;	// New string stream
-        stream << file.rdbuf();		// Read data
+        return ptr;
+    }
+
+    /// <summary>
+    /// Advances to the first character of the next line.
+    /// </summary>
+    static inline const char* skipLine(const char* ptr, const char* end)
+    {
+        auto eol = (const char*) memchr(ptr, '\n', end - ptr);
+        return eol ? eol + 1 : end;
+    }
 
-        std::string line;			// New buffer for the current line
+    /// <summary>
+    /// Parses a number at the given position, skipping leading blanks.
+    /// </summary>
+    /// <returns>The position after the number, or nullptr if there was no valid number.</returns>
+    template<typename T>
+    static inline const char* parseToken(const char* ptr, const char* end, T* value)
+    {
+        ptr = skipBlanks(ptr, end);
+        if (ptr < end && *ptr == '+')   // from_chars does not accept an explicit sign
+        {
+            ptr++;
+        }
+        auto [next, error] = std::from_chars(ptr, end, *value);
+        return error == std::errc() ? next : nullptr;
+    }
 
-        std::cout << "Reading file contents..." << std::endl;
+    /// <summary>
+    /// One face corner of an .obj file: its 0-based position, texture coordinate and normal
+    /// indices, with OBJ_NO_INDEX for attributes the corner does not reference. Indices with their
+    /// bit set in `relative` were negative in the file and are still relative to the first element
+    /// of their chunk until the chunks are merged.
+    /// </summary>
+    struct ObjCorner
+    {
+        int index[OBJ_ATTRIBUTE_COUNT] = { OBJ_NO_INDEX, OBJ_NO_INDEX, OBJ_NO_INDEX };
+        uint8 relative = 0;
 
-        // Keep reading until end-of-file
-        while (stream.peek() != -1)
+        bool operator == (const ObjCorner& other) const
         {
-            // (Safely) get the current line
-            readLine(stream, line);
-            std::cout << line << std::endl;
+            return index[0] == other.index[0] && index[1] == other.index[1] && index[2] == other.index[2] &&
+                   relative == other.relative;
+        }
+    };
+
+    static inline uint32 hashObjCorner(const ObjCorner& corner)
+    {
+        uint32 hash = (uint32) corner.index[0] * 0x9E3779B1u;
+        hash ^= (uint32) corner.index[1] * 0x85EBCA77u + (hash << 6) + (hash >> 2);
+        hash ^= (uint32) corner.index[2] * 0xC2B2AE3Du + (hash << 6) + (hash >> 2);
+        return hash ^ corner.relative;
+    }
+
+    /// <summary>
+    /// Collapses identical v/vt/vn corners into unique vertices as they are added, using an
+    /// open-addressing hash table with linear probing. The table grows to stay at most half full,
+    /// so it is sized by the unique corners rather than by every corner.
+    /// </summary>
+    struct ObjCornerTable
+    {
+        std::vector<int> slots;
+        size_t mask = 0;
 
-            if (line.starts_with('\0'))			// Skip if line is empty
+        void reserve(size_t count, const std::vector<ObjCorner>& unique)
+        {
+            if (count * 2 <= slots.size())
             {
-                continue;
+                return;
+            }
+
+            size_t capacity = 16;
+            while (capacity < count * 2)
+            {
+                capacity <<= 1;
+            }
+            slots.assign(capacity, -1);
+            mask = capacity - 1;
+            for (size_t i = 0; i < unique.size(); i++)
+            {
+                size_t slot = hashObjCorner(unique[i]) & mask;
+                while (slots[slot] != -1)
+                {
+                    slot = (slot + 1) & mask;
+                }
+                slots[slot] = (int) i;
             }
+        }
 
-            if (line.starts_with('#'))			// Skip if the line is commented
+        /// <summary>
+        /// Returns the index of the corner in the unique list, appending it first if it is new.
+        /// </summary>
+        uint32 insert(const ObjCorner& corner, std::vector<ObjCorner>& unique)
+        {
+            if ((unique.size() + 1) * 2 > slots.size())
             {
+                reserve(std::max(unique.size() * 2, (size_t) 8), unique);
+            }
+
+            size_t slot = hashObjCorner(corner) & mask;
+            while (slots[slot] != -1 && !(unique[slots[slot]] == corner))
+            {
+                slot = (slot + 1) & mask;
+            }
+
+            if (slots[slot] == -1)
+            {
+                slots[slot] = (int) unique.size();
+                unique.push_back(corner);
+            }
+            return (uint32) slots[slot];
+        }
+    };
+
+    /// <summary>
+    /// Geometry parsed from one newline-aligned slice of an .obj file. Its face corners are
+    /// deduplicated as they are read; triangles index this chunk's unique corners.
+    /// </summary>
+    struct ObjChunk
+    {
+        std::vector<Vector3> positions;
+        std::vector<Vector2> uvs;
+        std::vector<Vector3> normals;
+        std::vector<ObjCorner> corners;     // Unique within the chunk
+        std::vector<uint32> indices;        // Three per triangle, into corners
+
+        size_t getCount(int attribute) const
+        {
+            switch (attribute)
+            {
+            case OBJ_POSITION:
+                return positions.size();
+            case OBJ_UV:
+                return uvs.size();
+            default:
+                return normals.size();
+            }
+        }
+    };
+
+    /// <summary>
+    /// Parses the v/vt/vn indices of a single face corner, which may be written as
+    /// v, v/vt, v//vn or v/vt/vn.
+    /// </summary>
+    static const char* parseObjCorner(const char* ptr, const char* end, const ObjChunk& chunk, ObjCorner& corner)
+    {
+        for (int attribute = 0; attribute < OBJ_ATTRIBUTE_COUNT; attribute++)
+        {
+            if (attribute > 0)
+            {
+                if (ptr == end || *ptr != '/')
+                {
+                    break;
+                }
+                ptr++;
+            }
+
+            // An empty slot, as in v//vn
+            if (ptr == end || *ptr == '/' || isBlank(*ptr) || isLineEnd(*ptr))
+            {
+                if (attribute == OBJ_POSITION)
+                {
+                    return nullptr;
+                }
                 continue;
             }
 
-            // Pointer to first character in line
-            const char* token = line.c_str();
+            int index = 0;
+            auto [next, error] = std::from_chars(ptr, end, index);
+            if (error != std::errc() || index == 0 || index == OBJ_NO_INDEX)
+            {
+                return nullptr;
+            }
+            ptr = next;
+
+            // Account for .obj being 1-based. Negative indices count back from the last element
+            // read so far, which may live in an earlier chunk.
+            if (index > 0)
+            {
+                corner.index[attribute] = index - 1;
+            }
+            else
+            {
+                corner.index[attribute] = (int) chunk.getCount(attribute) + index;
+                corner.relative |= 1 << attribute;
+            }
+        }
+
+        // Anything else left in the token is malformed
+        if (ptr < end && !isBlank(*ptr) && !isLineEnd(*ptr))
+        {
+            return nullptr;
+        }
+        return ptr;
+    }
+
+    static void parseObjChunk(const char* ptr, const char* end, ObjChunk& chunk, LoadProgress* progress)
+    {
+        const char* reported = ptr;     // Progress has been reported up to here
+        std::vector<uint32> face;			// Unique corners of the face currently being read
+        ObjCornerTable table;
+
+        while (ptr < end)
+        {
+            ptr = skipWhitespace(ptr, end);
+            if (ptr == end)
+            {
+                break;
+            }
 
             // Vertices
-            if (*token == 'v')	// v 0.5 2.32843 -1.23
+            if (ptr[0] == 'v' && ptr + 1 < end && isBlank(ptr[1]))	// v 0.5 2.32843 -1.23
+            {
+                double x, y, z;
+                ptr = parseToken(ptr + 1, end, &x);
+                ptr = ptr ? parseToken(ptr, end, &y) : nullptr;
+                ptr = ptr ? parseToken(ptr, end, &z) : nullptr;
+                if (ptr == nullptr)
+                {
+                    throw std::runtime_error("Incorrect vertex definition.");
+                }
+
+                chunk.positions.emplace_back(x, y, z);
+            }
+
+            // Texture coordinates
+            else if (ptr[0] == 'v' && ptr + 2 < end && ptr[1] == 't' && isBlank(ptr[2]))	// vt 0.25 0.5
             {
-                std::istringstream istream(line);
-                std::string str;
-                std::vector<double> values;
+                double u, v = 0.0;
+                ptr = parseToken(ptr + 2, end, &u);
+                if (ptr == nullptr)
+                {
+                    throw std::runtime_error("Incorrect texture coordinate definition.");
+                }
 
-                // Split the line by spaces
-                while (std::getline(istream, str, ' '))
+                // The v coordinate is optional for 1D textures
+                const char* next = parseToken(ptr, end, &v);
+                ptr = next ? next : ptr;
+
+                chunk.uvs.emplace_back(u, v);
+            }
+
+            // Normals
+            else if (ptr[0] == 'v' && ptr + 2 < end && ptr[1] == 'n' && isBlank(ptr[2]))	// vn 0.0 1.0 0.0
+            {
+                double x, y, z;
+                ptr = parseToken(ptr + 2, end, &x);
+                ptr = ptr ? parseToken(ptr, end, &y) : nullptr;
+                ptr = ptr ? parseToken(ptr, end, &z) : nullptr;
+                if (ptr == nullptr)
                 {
-                    if (std::count(INVALID_VERTEX_TOKENS.begin(), INVALID_VERTEX_TOKENS.end(), str))
+                    throw std::runtime_error("Incorrect vertex normal definition.");
+                }
+
+                chunk.normals.emplace_back(x, y, z);
+            }
+
+            // Faces
+            else if (ptr[0] == 'f' && ptr + 1 < end && isBlank(ptr[1]))	// f 1/1/1 2/2/2 3/3/3 ... n
+            {
+                face.clear();
+                ptr++;
+
+                while (true)
+                {
+                    ptr = skipBlanks(ptr, end);
+                    if (ptr == end || isLineEnd(*ptr))
                     {
-                        continue;
+                        break;
                     }
 
-                    // Attempt to parse the result to a double
-                    double result = 0.0;
-                    if (parseNumber(str, &result))
+                    ObjCorner corner;
+                    ptr = parseObjCorner(ptr, end, chunk, corner);
+                    if (ptr == nullptr)
                     {
-                        // If it is a valid double, we'll append to our values array
-                        values.push_back(result);
+                        throw std::runtime_error("Incorrect index definition.");
                     }
+
+                    face.push_back(table.insert(corner, chunk.corners));
                 }
 
-                if (values.size() != 3)
+                // Check if we have less than 3 indices per face
+                if (face.size() < 3)
                 {
-                    throw std::runtime_error("Incorrect vertex definition.");
+                    throw std::runtime_error("Incorrect index definition.");
                 }
 
-                // Create a new Vertex and append it to the vertices array
-                Vertex vtx(values[0], values[1], values[2]);
-                vertices.push_back(vtx);
+                // Triangulate the face as a fan around the first corner
+                for (size_t i = 1; i + 1 < face.size(); i++)
+                {
+                    chunk.indices.push_back(face[0]);
+                    chunk.indices.push_back(face[i]);
+                    chunk.indices.push_back(face[i + 1]);
+                }
             }
 
-            if (*token == 'v' && *token + 1 == 'n')
+            // Comments, groups, materials and everything else are skipped
+            ptr = skipLine(ptr, end);
+
+            if (progress != nullptr && (size_t) (ptr - reported) >= OBJ_PROGRESS_INTERVAL)
             {
-                std::istringstream istream(line);
-                std::string str;
-                std::vector<double> values;
+                progress->completed += ptr - reported;
+                reported = ptr;
+            }
+        }
+
+        if (progress != nullptr)
+        {
+            progress->completed += ptr - reported;
+        }
+    }
+
+    /// <summary>
+    /// Publishes parsed OBJ chunks to a preview stream in file order. Chunks can finish parsing in
+    /// any order; whichever parser finds none being published becomes the publisher and keeps
+    /// claiming the run of parsed chunks that follows the published ones until there is none left.
+    /// </summary>
+    struct ObjPreview
+    {
+        TriangleStream* stream = nullptr;
+        std::vector<ObjChunk>* chunks = nullptr;
+
+        std::mutex mutex;
+        std::vector<bool> parsed;
+        size_t next = 0;                            // First chunk not yet claimed for publishing
+        bool publishing = false;                    // Whether a thread is publishing claimed chunks
+
+        // Only touched by the publishing thread
+        std::vector<size_t> positionStarts = { 0 };  // Global index of the first position of each published chunk
+        size_t triangles = 0;                       // In the published chunks
+    };
 
-                // Split the line by spaces
-                while (std::getline(istream, str, ' '))
+    /// <summary>
+    /// Appends the triangles of a claimed chunk to the preview stream and publishes them.
+    /// </summary>
+    static void publishObjChunk(ObjPreview& preview, size_t index)
+    {
+        const ObjChunk& chunk = (*preview.chunks)[index];
+        size_t positionStart = preview.positionStarts.back();
+        preview.positionStarts.push_back(positionStart + chunk.positions.size());
+        size_t positionCount = preview.positionStarts.back();
+
+        // Chunks are about the same size, so the ones so far tell how many triangles the
+        // whole file has and how sparsely the stream must sample them
+        preview.triangles += chunk.indices.size() / 3;
+        preview.stream->setExpectedCount(preview.triangles * preview.parsed.size() / (index + 1));
+
+        for (size_t corner = 0; corner + 2 < chunk.indices.size(); corner += 3)
+        {
+            Vector3 points[3];
+            bool valid = true;
+            for (size_t i = 0; i < 3; i++)
+            {
+                const ObjCorner& source = chunk.corners[chunk.indices[corner + i]];
+                size_t position = (size_t) source.index[OBJ_POSITION];
+                if (source.relative & (1 << OBJ_POSITION))
                 {
-                    if (std::count(INVALID_VERTEX_TOKENS.begin(), INVALID_VERTEX_TOKENS.end(), str))
-                    {
-                        continue;
-                    }
+                    position += positionStart;
+                }
 
-                    // Attempt to parse the result to a double
-                    double result = 0.0;
-                    if (parseNumber(str, &result))
-                    {
-                        // If it is a valid double, we'll append to our values array
-                        values.push_back(result);
-                    }
+                // Bad indices are reported once the whole file is merged; the preview just skips them
+                if (position >= positionCount)
+                {
+                    valid = false;
+                    break;
                 }
 
-                if (values.size() != 3)
+                size_t owner = std::upper_bound(preview.positionStarts.begin(), preview.positionStarts.end(), position)
+                               - preview.positionStarts.begin() - 1;
+                points[i] = (*preview.chunks)[owner].positions[position - preview.positionStarts[owner]];
+            }
+
+            if (valid)
+            {
+                preview.stream->append(points[0], points[1], points[2]);
+            }
+        }
+
+        preview.stream->publish();
+    }
+
+    /// <summary>
+    /// Marks a chunk as parsed and, unless another thread is already publishing, publishes every
+    /// chunk that is now ready. Only claiming chunks holds the lock, so other parsers are never
+    /// kept waiting on the stream.
+    /// </summary>
+    static void onObjChunkParsed(ObjPreview& preview, size_t index)
+    {
+        size_t first;
+        size_t last;
+        {
+            std::lock_guard<std::mutex> lock(preview.mutex);
+            preview.parsed[index] = true;
+            if (preview.publishing)
+            {
+                return;
+            }
+            preview.publishing = true;
+        }
+
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(preview.mutex);
+                first = preview.next;
+                while (preview.next < preview.parsed.size() && preview.parsed[preview.next])
                 {
-                    throw std::runtime_error("Incorrect vertex normal definition.");
+                    preview.next++;
                 }
+                last = preview.next;
 
-                // Create a new Vertex and append it to the vertices array
-                Vector3 normal(values[0], values[1], values[2]);
-                normals.push_back(normal);
+                // Cleared under the lock, so a chunk marked parsed after this is claimed by its own parser
+                if (first == last)
+                {
+                    preview.publishing = false;
+                    return;
+                }
             }
 
-            // Indices
-            if (*token == 'f')	// f 0 2 3 ... n
+            for (size_t i = first; i < last; i++)
             {
-                std::istringstream istream(line);
-                std::string str;
-                std::vector<int> values;
+                publishObjChunk(preview, i);
+            }
+        }
+    }
+
+    Mesh* loadObjFile(const std::string& filename, LoadProgress* progress)
+    {
+        MappedFile file;
+        if (!file.open(filename))
+        {
+            throw std::runtime_error("Invalid file: " + filename);
+        }
+
+        // Parsing and per-chunk deduplication are the bulk of the work; the merge counts as the last tenth
+        if (progress != nullptr)
+        {
+            progress->total = file.size() + file.size() / 10;
+        }
+
+        const char* begin = file.begin();
+        const char* end = file.end();
+
+        // Split the file into slices of about OBJ_CHUNK_SIZE. Every slice boundary is moved forward
+        // to the start of the next line so no line is shared between two chunks.
+        size_t chunkCount = std::max(file.size() / OBJ_CHUNK_SIZE, (size_t) 1);
+        std::vector<const char*> bounds = { begin };
+        for (size_t i = 1; i < chunkCount; i++)
+        {
+            const char* split = std::max(begin + file.size() * i / chunkCount, bounds.back());
+            bounds.push_back(skipLine(split, end));
+        }
+        bounds.push_back(end);
+
+        std::vector<ObjChunk> chunks(chunkCount);
 
-                // Split the line by spaces
-                while (std::getline(istream, str, ' '))
+        std::unique_ptr<ObjPreview> preview;
+        if (progress != nullptr && progress->preview != nullptr)
+        {
+            preview = std::make_unique<ObjPreview>();
+            preview->stream = progress->preview;
+            preview->chunks = &chunks;
+            preview->parsed.resize(chunkCount, false);
+        }
+
+        // Parse every chunk concurrently. Chunks are handed out in file order so the front of the
+        // file finishes first and can be previewed while the rest is still being parsed.
+        std::atomic<size_t> nextChunk = 0;
+        parallelFor(std::min(chunkCount, getThreadCount()), 1, [&](size_t, size_t)
+        {
+            for (size_t i = nextChunk++; i < chunkCount; i = nextChunk++)
+            {
+                parseObjChunk(bounds[i], bounds[i + 1], chunks[i], progress);
+                if (preview != nullptr)
                 {
-                    if (std::count(INVALID_FACE_TOKENS.begin(), INVALID_FACE_TOKENS.end(), str))
-                    {
-                        continue;
-                    }
+                    onObjChunkParsed(*preview, i);
+                }
+            }
+        });
 
-                    // Account for v/vt/vn in one face
-                    std::vector<std::string> segments = splitString(str, '/');
-                    if (segments.size() > 1)
-                    {
-                        str = segments[0];
-                    }
+        // Prefix sums of the per-chunk counts give each chunk its global offsets
+        std::vector<std::array<size_t, OBJ_ATTRIBUTE_COUNT>> offsets(chunkCount + 1);
+        std::vector<size_t> cornerOffsets(chunkCount + 1, 0);
+        std::vector<size_t> indexOffsets(chunkCount + 1, 0);
+        for (size_t i = 0; i < chunkCount; i++)
+        {
+            for (int attribute = 0; attribute < OBJ_ATTRIBUTE_COUNT; attribute++)
+            {
+                offsets[i + 1][attribute] = offsets[i][attribute] + chunks[i].getCount(attribute);
+            }
+            cornerOffsets[i + 1] = cornerOffsets[i] + chunks[i].corners.size();
+            indexOffsets[i + 1] = indexOffsets[i] + chunks[i].indices.size();
+        }
 
-                    // Attempt to parse the result to an integer
-                    int result = 0;
-                    if (parseNumber(str, &result))
+        std::vector<Vector3> positions(offsets.back()[OBJ_POSITION]);
+        std::vector<Vector2> uvs(offsets.back()[OBJ_UV]);
+        std::vector<Vector3> normals(offsets.back()[OBJ_NORMAL]);
+        std::vector<ObjCorner> corners(cornerOffsets.back());
+
+        // Resolve the relative indices of each chunk's unique corners and concatenate the chunks.
+        // A missing attribute is OBJ_NO_INDEX, so anything else that resolves out of range,
+        // including -1, is an error.
+        parallelFor(chunkCount, 1, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                ObjChunk& chunk = chunks[i];
+                for (ObjCorner& corner : chunk.corners)
+                {
+                    for (int attribute = 0; attribute < OBJ_ATTRIBUTE_COUNT; attribute++)
                     {
-                        // If it is a valid integer, we'll append to our values array
-                        values.push_back(result - 1); // Account for .obj being 1-based
+                        int& index = corner.index[attribute];
+                        if (corner.relative & (1 << attribute))
+                        {
+                            index += (int) offsets[i][attribute];
+                        }
+                        else if (index == OBJ_NO_INDEX && attribute != OBJ_POSITION)
+                        {
+                            continue;
+                        }
+
+                        if (index < 0 || index >= (int) offsets.back()[attribute])
+                        {
+                            throw std::runtime_error("Face index out of range.");
+                        }
                     }
+                    corner.relative = 0;
                 }
 
-                // Check if we have less than 3 indices per face
-                if (values.size() < 3)
+                std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + offsets[i][OBJ_POSITION]);
+                std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + offsets[i][OBJ_UV]);
+                std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + offsets[i][OBJ_NORMAL]);
+                std::copy(chunk.corners.begin(), chunk.corners.end(), corners.begin() + cornerOffsets[i]);
+                chunk.positions = std::vector<Vector3>();
+                chunk.uvs = std::vector<Vector2>();
+                chunk.normals = std::vector<Vector3>();
+                chunk.corners = std::vector<ObjCorner>();
+            }
+        });
+
+        // Merge the per-chunk unique sets. Only corners shared between chunks collapse here, so
+        // this pass and its table scale with the unique corners rather than with every corner.
+        std::vector<ObjCorner> unique;
+        std::vector<uint32> remap(corners.size());
+        ObjCornerTable table;
+        table.reserve(corners.size(), unique);
+        for (size_t i = 0; i < corners.size(); i++)
+        {
+            remap[i] = table.insert(corners[i], unique);
+        }
+        corners = std::vector<ObjCorner>();
+        table = ObjCornerTable();
+
+        std::vector<uint32> indices(indexOffsets.back());
+        parallelFor(chunkCount, 1, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                ObjChunk& chunk = chunks[i];
+                for (size_t k = 0; k < chunk.indices.size(); k++)
                 {
-                    throw std::runtime_error("Incorrect index definition.");
+                    indices[indexOffsets[i] + k] = remap[cornerOffsets[i] + chunk.indices[k]];
                 }
+                chunk = ObjChunk();
+            }
+        });
 
-                // Append each index to the indices array
-                int triCount = (int) values.size() - 2;
-                for (int i = 0; i < triCount; i++)
+        // Gather the attributes of each unique corner into the mesh streams. Normal and UV streams
+        // are only kept when the file has any; corners without one get zeros.
+        std::vector<float> vertexPositions(unique.size() * 3);
+        std::vector<float> vertexNormals(normals.empty() ? 0 : unique.size() * 3, 0.0f);
+        std::vector<float> vertexUVs(uvs.empty() ? 0 : unique.size() * 2, 0.0f);
+        parallelFor(unique.size(), 4096, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                const ObjCorner& corner = unique[i];
+                const Vector3& position = positions[corner.index[OBJ_POSITION]];
+                vertexPositions[i * 3] = (float) position._x;
+                vertexPositions[i * 3 + 1] = (float) position._y;
+                vertexPositions[i * 3 + 2] = (float) position._z;
+                if (corner.index[OBJ_NORMAL] != OBJ_NO_INDEX)
                 {
-                    int i1 = 0;
-                    int i2 = i + 1;
-                    int i3 = i + 2;
-
-                    indices.push_back(values[i1]);
-                    indices.push_back(values[i2]);
-                    indices.push_back(values[i3]);
+                    const Vector3& normal = normals[corner.index[OBJ_NORMAL]];
+                    vertexNormals[i * 3] = (float) normal._x;
+                    vertexNormals[i * 3 + 1] = (float) normal._y;
+                    vertexNormals[i * 3 + 2] = (float) normal._z;
+                }
+                if (corner.index[OBJ_UV] != OBJ_NO_INDEX)
+                {
+                    const Vector2& uv = uvs[corner.index[OBJ_UV]];
+                    vertexUVs[i * 2] = (float) uv._x;
+                    vertexUVs[i * 2 + 1] = (float) uv._y;
                 }
             }
+        });
+
+        // Allocated last, so nothing thrown above can leak it
+        Mesh* mesh = new Mesh();
+        mesh->setPositions(std::move(vertexPositions));
+        mesh->setNormals(std::move(vertexNormals));
+        mesh->setUVs(std::move(vertexUVs));
+        mesh->setIndices(std::move(indices));
+        mesh->computeFaceData();
+        mesh->computeBounds();
+
+        return mesh;
+    }
+
+    /// <summary>
+    /// Runs the optional post-parse passes over a mesh, skipping the ones its cache flags say are
+    /// already done, and builds its BVH.
+    /// </summary>
+    /// <returns>Whether the mesh was changed.</returns>
+    static bool processMesh(Mesh* mesh, const LoadOptions& options, uint32 doneFlags = 0)
+    {
+        bool changed = false;
+        bool reordered = false;
+        if (options.generateNormals && !mesh->hasNormals())
+        {
+            mesh->computeVertexNormals();
+            changed = true;
         }
 
-        mesh->setVertices(vertices);
-        mesh->setIndices(indices);
-        mesh->bindTris();
+        if (options.optimize && (doneFlags & MESH_CACHE_OPTIMIZED) == 0)
+        {
+            MeshOptimizeStats stats = optimizeMesh(mesh);
+            std::cout << "Vertex cache ACMR: " << stats.acmrBefore << " -> " << stats.acmrAfter << std::endl;
+            changed = true;
+            reordered = true;
+        }
+
+        // Built after any reordering, from the final triangles; a cached BVH is used as it is
+        if (options.buildBvh && (reordered || mesh->getBvh().empty()))
+        {
+            mesh->computeBvh();
+            changed = true;
+        }
+
+        return changed;
+    }
+
+    Mesh* loadMeshFile(const std::string& filename, const LoadOptions& options, LoadProgress* progress)
+    {
+        // Binary glTF is read straight from its buffers, it does not need a cache
+        std::string extension = filename.substr(std::min(filename.find_last_of('.'), filename.size()));
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (extension == ".glb")
+        {
+            Mesh* mesh = loadGlbFile(filename, progress);
+            processMesh(mesh, options);
+            if (progress != nullptr)
+            {
+                progress->finish();
+            }
+            return mesh;
+        }
+
+        uint32 cacheFlags = options.optimize ? MESH_CACHE_OPTIMIZED : 0;
+
+        // A cache missing a requested pass gets it now and is rewritten. An optimized cache is
+        // fine either way, it is only the order that differs.
+        uint32 cachedFlags = 0;
+        Mesh* mesh = readMeshCache(filename, &cachedFlags);
+        if (mesh != nullptr && processMesh(mesh, options, cachedFlags))
+        {
+            writeMeshCache(filename, mesh, cachedFlags | cacheFlags);
+        }
+
+        if (mesh == nullptr)
+        {
+            mesh = loadObjFile(filename, progress);
+            processMesh(mesh, options);
+            if (!writeMeshCache(filename, mesh, cacheFlags))
+            {
+                std::cout << "Unable to write mesh cache for " << filename << std::endl;
+            }
+        }
+
+        if (progress != nullptr)
+        {
+            progress->finish();
+        }
 
         return mesh;
     }
@@ -1,19 +1,31 @@
 #ifndef FILELOADER_H
 #define FILELOADER_H
 
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <climits>
 #include <iostream>
 #include <iterator>
 #include <fstream>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <string>
 
 #include "core.h"
+#include "json.h"
+#include "mappedfile.h"
 #include "mesh.h"
+#include "meshcache.h"
+#include "meshoptimizer.h"
+#include "parallel.h"
 #include "shader.h"
+#include "trianglestream.h"
 
 constexpr auto FILE_FILTER_OBJ = "Wavefront OBJ (.obj)\0*.obj\0";
-#define FILE_FILTER_GLB L"GLB (.glb)\0*.glb\0"
+constexpr auto FILE_FILTER_GLB = "GLB (.glb)\0*.glb\0";
+constexpr auto FILE_FILTER_MODEL = "All models (.obj, .glb)\0*.obj;*.glb\0Wavefront OBJ (.obj)\0*.obj\0GLB (.glb)\0*.glb\0";
 #define FILE_FILTER_SHADER L"Pixel Shader File (.ini)\0*.pxl\0"
 
 namespace Graphics
@@ -21,12 +33,10 @@ namespace Graphics
     enum FileTypes
     {
         Obj,
-        Gltf
+        Gltf,
+        Model
     };
 
-    static std::vector<const char*> INVALID_VERTEX_TOKENS = { "v", "vn", "vt", "", " " };
-    static std::vector<const char*> INVALID_FACE_TOKENS = { "f", "", " " };
-
     static std::istream& readLine(std::istream& stream, std::string& line)
     {
         // Clear the content of the line
@@ -144,13 +154,61 @@ namespace Graphics
         }
     }
 
+/// <summary>
+/// Progress of a model load. Written by the loading thread(s) and safe to read from any other thread.
+/// </summary>
+    struct LoadProgress
+    {
+        std::atomic<uint64> completed = 0;
+        std::atomic<uint64> total = 0;
+
+        // Optional. When set, the loader publishes finished triangles here while it runs.
+        TriangleStream* preview = nullptr;
+
+        /// <summary>
+        /// Returns the completed fraction of the load, from 0 to 1.
+        /// </summary>
+        double getFraction() const
+        {
+            uint64 t = total.load(std::memory_order_relaxed);
+            return t == 0 ? 0.0 : std::min(1.0, (double) completed.load(std::memory_order_relaxed) / (double) t);
+        }
+
+        /// <summary>
+        /// Marks the load as complete.
+        /// </summary>
+        void finish()
+        {
+            total = std::max<uint64>(total, 1);
+            completed = total.load();
+        }
+    };
+
+/// <summary>
+/// Options for what happens to a mesh after it is parsed.
+/// </summary>
+    struct LoadOptions
+    {
+        bool optimize = true;           // Reorder triangles and vertices for vertex cache and fetch locality
+        bool generateNormals = true;    // Generate smooth vertex normals for meshes that have none
+        bool buildBvh = true;           // Build a triangle BVH for ray queries such as picking
+    };
+
 /// <summary>
 /// Wrapper for GetOpenFileNameW to simplify the parameter inputs.
 /// </summary>
     bool getOpenFilename(FileTypes type, std::string& filename);
 
-    Mesh* loadGlbFile(const std::string& filename);
-    Mesh* loadObjFile(const std::string& filename);
+    Mesh* loadGlbFile(const std::string& filename, LoadProgress* progress = nullptr);
+    Mesh* loadObjFile(const std::string& filename, LoadProgress* progress = nullptr);
+
+/// <summary>
+/// Loads the given model file, going through its binary mesh cache. If the cache is missing or
+/// out of date the source file is parsed and a new cache is written next to it. Optimized meshes
+/// are cached already optimized.
+/// </summary>
+    Mesh* loadMeshFile(const std::string& filename, const LoadOptions& options = LoadOptions(),
+                       LoadProgress* progress = nullptr);
     StandardShader* loadShaderFile(const std::string& filename);
 }
 
@@ -1,4 +1,7 @@
+#include <atomic>
+
 #include "framebuffer.h"
+#include "parallel.h"
 
 namespace Graphics {
 using namespace Graphics;
@@ -31,14 +34,47 @@ Framebuffer::~Framebuffer()
 
 }
 
-HBITMAP Framebuffer::getBitmap()
+// IDs are packed into one channel value; doubles hold integers exactly up to 2^53, which leaves
+// 21 bits for the object
+constexpr double PIXEL_ID_OBJECT_SCALE = 4294967296.0;
+
+void Framebuffer::setIdChannel(bool enabled)
 {
-    return CreateBitmap(m_width, m_height, 1, sizeof(double) * 4, m_displayBuffer);
+    if (enabled && m_idChannel == nullptr)
+    {
+        m_idChannel = new Channel(CHANNEL_ID, m_width, m_height);
+        m_idChannel->fill(-1.0);
+        m_channels[CHANNEL_ID] = m_idChannel;
+    }
+    else if (!enabled && m_idChannel != nullptr)
+    {
+        m_channels.erase(CHANNEL_ID);
+        delete m_idChannel;
+        m_idChannel = nullptr;
+    }
+}
+
+PixelId Framebuffer::pick(int x, int y)
+{
+    PixelId id;
+    if (m_idChannel == nullptr || x < 0 || y < 0 || x >= m_width || y >= m_height)
+    {
+        return id;
+    }
+
+    double value = m_idChannel->getPixel(x, y);
+    if (value >= 0.0)
+    {
+        double object = std::floor(value / PIXEL_ID_OBJECT_SCALE);
+        id.object = (uint32) object;
+        id.triangle = (uint32) (value - object * PIXEL_ID_OBJECT_SCALE);
+    }
+    return id;
 }
 
-void Framebuffer::bindTriangleBuffer(std::vector<Triangle*> data)
+HBITMAP Framebuffer::getBitmap()
 {
-    m_triangles = data;
+    return CreateBitmap(m_width, m_height, 1, sizeof(double) * 4, m_displayBuffer);
 }
 
 Vector3 Framebuffer::worldToScreen(Vector3* v)
@@ -72,6 +108,32 @@ Vector3 Framebuffer::screenToWorld(double x, double y, double depth)
     return Vector3(worldPosition._x, worldPosition._y, worldPosition._z);
 }
 
+Ray Framebuffer::screenToRay(double x, double y)
+{
+    // Pixels are sampled one unit in from their corner, see drawTriangle()
+    double ndcX = 2.0 * ((x + 1.0) / (double) m_width) - 1.0;
+    double ndcY = 2.0 * ((y + 1.0) / (double) m_height) - 1.0;
+
+    // Points projecting to ndcX lie on the plane row0 - ndcX * row3, which passes through the eye,
+    // and likewise for ndcY. The ray runs along where the two planes meet. Unprojecting a depth
+    // instead, as screenToWorld() does, is unreliable with the near plane at the eye.
+    Vector3 row0(m_mvp[0][0], m_mvp[0][1], m_mvp[0][2]);
+    Vector3 row1(m_mvp[1][0], m_mvp[1][1], m_mvp[1][2]);
+    Vector3 row3(m_mvp[3][0], m_mvp[3][1], m_mvp[3][2]);
+    Vector3 direction = normalize(cross(row0 - row3 * ndcX, row1 - row3 * ndcY));
+
+    // Points in front of the camera have a negative w
+    if (dot(direction, row3) > 0.0)
+    {
+        direction = direction * -1.0;
+    }
+
+    Ray ray;
+    ray.origin = m_camera.getTranslation();
+    ray.direction = direction;
+    return ray;
+}
+
 double Framebuffer::getDepth(Vector3* v1, Vector3* v2, Vector3* v3, Vector3* p)
 {
     // Calculate area of this triangle
@@ -234,24 +296,19 @@ bool Framebuffer::drawCircle(Vector3* v, double r)
     return true;
 }
 
-bool Framebuffer::drawTriangle(Triangle* triangle)
+bool Framebuffer::drawTriangle(Vector3 v1, Vector3 v2, Vector3 v3, Vector3 worldNormal, const Vector3* colors,
+                               PixelId id)
 {
-    // Construct a new shader for this triangle
-    StandardShader* shader = new StandardShader();
+    // Set up the shader for this triangle
+    StandardShader standardShader;
+    StandardShader* shader = &standardShader;
 
     shader->width = m_width;
     shader->height = m_height;
     shader->matrix = m_mvp;
     shader->viewPosition = m_camera.getTranslation();
+    shader->lightPosition = m_lightPosition;
 
-    // Get model-space vertex positions of the triangle
-    Vector3 v1 = triangle->v1()->getTranslation();
-    Vector3 v2 = triangle->v2()->getTranslation();
-    Vector3 v3 = triangle->v3()->getTranslation();
-
-    // Calculate world normal
-    Vector3 worldNormal = getNormal(v1, v2, v3);
-    worldNormal.normalize();
     shader->worldNormal = worldNormal;
 
     // Convert world normal to view normal
@@ -269,6 +326,7 @@ bool Framebuffer::drawTriangle(Triangle* triangle)
     viewNormal.rescale<double>(-1.0, 1.0, 0.0, 1.0);
 
     // Convert world-space to screenspace by running through the vertex shader
+    Vector3 worldCorner = v1;
     shader->vertex(&v1);
     shader->vertex(&v2);
     shader->vertex(&v3);
@@ -290,6 +348,8 @@ bool Framebuffer::drawTriangle(Triangle* triangle)
     int x1 = bounds.getMax().x;
     int y1 = bounds.getMax().y;
 
+    double packedId = id.isValid() ? id.object * PIXEL_ID_OBJECT_SCALE + id.triangle : -1.0;
+
     // Draw each pixel within the bounding box
     for (int y = y0; y < y1; y++)
     {
@@ -330,12 +390,33 @@ bool Framebuffer::drawTriangle(Triangle* triangle)
 
             // Store z-depth in channel
             getChannel(CHANNEL_Z)->setPixel(pixelOffset, z);
+            if (m_idChannel != nullptr)
+            {
+                m_idChannel->setPixel(x, y, packedId);
+            }
 
-            // Get world position from the current pixel, given the current depth
-            shader->worldPosition = screenToWorld(x, y, z);
+            // The world position is where the pixel's ray meets the triangle's plane. Unprojecting
+            // the depth, as screenToWorld() does, is unreliable with the near plane at the eye.
+            shader->inShadow = false;
+            if (colors == nullptr || m_shadowsActive)
+            {
+                Ray ray = screenToRay(x, y);
+                double facing = dot(ray.direction, worldNormal);
+                shader->worldPosition = facing != 0.0 ? ray.at(dot(worldCorner - ray.origin, worldNormal) / facing) : worldCorner;
+                shader->inShadow = m_shadowsActive && isShadowed(shader->worldPosition, worldNormal);
+            }
 
-            // Compute fragment shader to get the final pixel color
-            Vector3 finalColor = shader->fragment();
+            Vector3 finalColor;
+            if (colors != nullptr && !shader->inShadow)
+            {
+                // Gouraud: blend the colors lit at the corners
+                finalColor = colors[0] * uvw._x + colors[1] * uvw._y + colors[2] * uvw._z;
+            }
+            else
+            {
+                // Compute fragment shader to get the final pixel color
+                finalColor = shader->fragment();
+            }
 
             // Set final color in RGB buffer
             getChannel(CHANNEL_R)->setPixel(pixelOffset, finalColor._x);
@@ -347,6 +428,477 @@ bool Framebuffer::drawTriangle(Triangle* triangle)
     return true;
 }
 
+int Framebuffer::drawMesh(const Matrix4& model, uint32 object)
+{
+    // Clip planes in the mesh's own space, so bounds and face planes are tested untransformed
+    Frustum frustum(m_mvp * model, m_camera.getFarClip());
+
+    // Skip the whole instance when its bounding sphere is out of view
+    if (!m_mesh.bounds.isEmpty() &&
+        !frustum.intersectsSphere(m_mesh.bounds.getCenter(), m_mesh.bounds.getSize().length() * 0.5))
+    {
+        return 0;
+    }
+
+    double determinant = 0.0;
+    Matrix4 inverse = Matrix4(model).getInverse(&determinant);
+    if (determinant == 0.0)
+    {
+        return 0;
+    }
+
+    // Planes keep which side a point is on under any invertible affine transform, so culling
+    // against the eye in mesh space gives the same answer as in world space
+    Vector3 worldEye = m_camera.getTranslation();
+    Vector4 objectEye = inverse * Vector4(worldEye, 1.0);
+    Vector3 eye(objectEye._x, objectEye._y, objectEye._z);
+
+    // Normals go through the inverse transpose, without the translation
+    Matrix4 normalMatrix = inverse.getTranspose();
+    normalMatrix[3][0] = 0.0;
+    normalMatrix[3][1] = 0.0;
+    normalMatrix[3][2] = 0.0;
+
+    // Cull in mesh space first, whole meshlets and then single faces, so only the triangles left
+    // have their vertices transformed and lit
+    m_drawTriangles.clear();
+    for (const Meshlet& meshlet : m_mesh.meshlets)
+    {
+        if (!frustum.intersectsSphere(meshlet.getCenter(), meshlet.radius) ||
+            (m_cullBackfaces && meshlet.isBackfacing(eye)))
+        {
+            continue;
+        }
+
+        size_t last = (size_t) meshlet.firstTriangle + meshlet.triangleCount;
+        for (size_t i = meshlet.firstTriangle; i < last; i++)
+        {
+            // Faces whose plane has the camera behind it can't be seen
+            if (m_cullBackfaces && m_mesh.getFaceDistance(i, eye) <= 0.0)
+            {
+                continue;
+            }
+            m_drawTriangles.push_back((uint32) i);
+        }
+    }
+
+    // Transform the vertices of those triangles once each, up front. An identity model, the
+    // common single mesh case, reads the mesh streams directly. Gouraud shading lights each of
+    // them once too, rather than every pixel of every triangle.
+    bool transformed = model != Matrix4();
+    bool gouraud = m_shadingMode == ShadingMode::Gouraud && m_mesh.hasNormals();
+    auto getWorldPosition = [&](uint32 vertex)
+    {
+        if (!transformed)
+        {
+            return m_mesh.getPosition(vertex);
+        }
+        const float* p = &m_instancePositions[(size_t) vertex * 3];
+        return Vector3(p[0], p[1], p[2]);
+    };
+    auto getWorldNormal = [&](Vector3 normal)
+    {
+        if (transformed)
+        {
+            normal = normalMatrix * normal;
+            normal.normalize();
+        }
+        return normal;
+    };
+
+    if (transformed || gouraud)
+    {
+        // Stamps mark the vertices already gathered for this draw; they restart once they wrap
+        m_vertexStamps.resize(m_mesh.numVertices(), 0);
+        if (++m_drawStamp == 0)
+        {
+            std::fill(m_vertexStamps.begin(), m_vertexStamps.end(), 0);
+            m_drawStamp = 1;
+        }
+
+        m_drawVertices.clear();
+        for (uint32 triangle : m_drawTriangles)
+        {
+            for (size_t corner = 0; corner < 3; corner++)
+            {
+                uint32 vertex = m_mesh.indices[(size_t) triangle * 3 + corner];
+                if (m_vertexStamps[vertex] != m_drawStamp)
+                {
+                    m_vertexStamps[vertex] = m_drawStamp;
+                    m_drawVertices.push_back(vertex);
+                }
+            }
+        }
+
+        if (transformed)
+        {
+            m_instancePositions.resize(m_mesh.positions.size());
+        }
+        if (gouraud)
+        {
+            m_vertexColors.resize(m_mesh.numVertices());
+        }
+        parallelFor(m_drawVertices.size(), MESH_PARALLEL_BATCH_SIZE, [&](size_t first, size_t last)
+        {
+            StandardShader shader;
+            shader.viewPosition = worldEye;
+            shader.lightPosition = m_lightPosition;
+            for (size_t i = first; i < last; i++)
+            {
+                uint32 v = m_drawVertices[i];
+                if (transformed)
+                {
+                    Vector4 p = model * Vector4(m_mesh.getPosition(v), 1.0);
+                    m_instancePositions[(size_t) v * 3] = (float) p._x;
+                    m_instancePositions[(size_t) v * 3 + 1] = (float) p._y;
+                    m_instancePositions[(size_t) v * 3 + 2] = (float) p._z;
+                }
+                if (gouraud)
+                {
+                    m_vertexColors[v] = shader.shade(getWorldPosition(v), getWorldNormal(m_mesh.getNormal(v)));
+                }
+            }
+        });
+    }
+
+    int count = 0;
+    for (uint32 i : m_drawTriangles)
+    {
+        uint32 i1 = m_mesh.indices[(size_t) i * 3];
+        uint32 i2 = m_mesh.indices[(size_t) i * 3 + 1];
+        uint32 i3 = m_mesh.indices[(size_t) i * 3 + 2];
+        Vector3 colors[3];
+        if (gouraud)
+        {
+            colors[0] = m_vertexColors[i1];
+            colors[1] = m_vertexColors[i2];
+            colors[2] = m_vertexColors[i3];
+        }
+
+        if (drawTriangle(getWorldPosition(i1), getWorldPosition(i2), getWorldPosition(i3),
+                         getWorldNormal(m_mesh.getFaceNormal(i)), gouraud ? colors : nullptr, { object, m_mesh.getSourceTriangle(i) }))
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void Framebuffer::drawOccluders()
+{
+    m_occlusionBuffer.begin(m_mvp, m_width, m_height);
+
+    // Order the instances in view by the depth of their bounds' center
+    Vector4 depthRow(m_mvp[3][0], m_mvp[3][1], m_mvp[3][2], m_mvp[3][3]);
+    Vector3 center = m_mesh.bounds.getCenter();
+    double radius = m_mesh.bounds.getSize().length() * 0.5;
+    m_occluderOrder.clear();
+    for (size_t i = 0; i < m_instances.size(); i++)
+    {
+        Matrix4 model = m_model * m_instances[i];
+        if (!Frustum(m_mvp * model, m_camera.getFarClip()).intersectsSphere(center, radius))
+        {
+            continue;
+        }
+
+        Vector4 worldCenter = model * Vector4(center, 1.0);
+        double depth = -(depthRow._x * worldCenter._x + depthRow._y * worldCenter._y + depthRow._z * worldCenter._z + depthRow._w);
+        m_occluderOrder.push_back({ depth, i });
+    }
+
+    size_t count = std::min(m_occluderOrder.size(), OCCLUSION_MAX_OCCLUDERS);
+    std::partial_sort(m_occluderOrder.begin(), m_occluderOrder.begin() + count, m_occluderOrder.end());
+    for (size_t i = 0; i < count; i++)
+    {
+        m_occlusionBuffer.drawOccluder(m_occluder, m_model * m_instances[m_occluderOrder[i].second], m_occluderError);
+    }
+}
+
+void Framebuffer::gatherTracedInstances()
+{
+    m_tracedInstances.clear();
+    Vector3 center = m_mesh.bounds.getCenter();
+    double radius = m_mesh.bounds.getSize().length() * 0.5;
+    const Vector3& min = m_mesh.bounds.getMin();
+    const Vector3& max = m_mesh.bounds.getMax();
+
+    size_t count = m_instances.empty() ? 1 : m_instances.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        Matrix4 model = m_instances.empty() ? m_model : m_model * m_instances[i];
+        Matrix4 m = m_mvp * model;
+        if (!Frustum(m, m_camera.getFarClip()).intersectsSphere(center, radius))
+        {
+            continue;
+        }
+
+        TracedInstance instance;
+        double determinant = 0.0;
+        instance.inverse = Matrix4(model).getInverse(&determinant);
+        if (determinant == 0.0)
+        {
+            continue;
+        }
+        instance.normalMatrix = instance.inverse.getTranspose();
+        instance.normalMatrix[3][0] = 0.0;
+        instance.normalMatrix[3][1] = 0.0;
+        instance.normalMatrix[3][2] = 0.0;
+        instance.object = (uint32) i;
+
+        // Screen rectangle of the bounds' corners. A box reaching behind the eye can cover
+        // anything, so it gets the whole screen.
+        double minX = DBL_MAX, minY = DBL_MAX, maxX = -DBL_MAX, maxY = -DBL_MAX;
+        bool crossesEye = false;
+        for (int c = 0; c < 8 && !crossesEye; c++)
+        {
+            Vector3 corner(c & 1 ? max._x : min._x, c & 2 ? max._y : min._y, c & 4 ? max._z : min._z);
+            double clipX = m[0][0] * corner._x + m[0][1] * corner._y + m[0][2] * corner._z + m[0][3];
+            double clipY = m[1][0] * corner._x + m[1][1] * corner._y + m[1][2] * corner._z + m[1][3];
+            double clipW = m[3][0] * corner._x + m[3][1] * corner._y + m[3][2] * corner._z + m[3][3];
+            crossesEye = clipW >= 0.0;
+            if (!crossesEye)
+            {
+                double x = (clipX / clipW + 1.0) * m_width * 0.5;
+                double y = (clipY / clipW + 1.0) * m_height * 0.5;
+                minX = std::min(minX, x);
+                minY = std::min(minY, y);
+                maxX = std::max(maxX, x);
+                maxY = std::max(maxY, y);
+            }
+        }
+
+        // Pixel x samples the point x + 1; round outwards by a pixel to stay conservative
+        if (crossesEye)
+        {
+            instance.x0 = 0;
+            instance.y0 = 0;
+            instance.x1 = m_width - 1;
+            instance.y1 = m_height - 1;
+        }
+        else
+        {
+            instance.x0 = (int) std::max(std::floor(minX) - 1.0, 0.0);
+            instance.y0 = (int) std::max(std::floor(minY) - 1.0, 0.0);
+            instance.x1 = (int) std::min(std::ceil(maxX), m_width - 1.0);
+            instance.y1 = (int) std::min(std::ceil(maxY), m_height - 1.0);
+        }
+        if (instance.x0 <= instance.x1 && instance.y0 <= instance.y1)
+        {
+            m_tracedInstances.push_back(instance);
+        }
+    }
+}
+
+bool Framebuffer::shouldRayTrace()
+{
+    double triangles = (double) m_mesh.numTriangles();
+    double depth = std::log2(std::max(triangles, 2.0));
+    double rasterCost = 0.0;
+    double traceCost = 0.0;
+    for (const TracedInstance& instance : m_tracedInstances)
+    {
+        double pixels = (double) (instance.x1 - instance.x0 + 1) * (instance.y1 - instance.y0 + 1);
+        rasterCost += triangles;
+        traceCost += pixels * depth * RAY_STEP_COST;
+    }
+    return traceCost < rasterCost;
+}
+
+int Framebuffer::traceMesh()
+{
+    const Bvh& bvh = *m_mesh.bvh;
+    Channel* r = getChannel(CHANNEL_R);
+    Channel* g = getChannel(CHANNEL_G);
+    Channel* b = getChannel(CHANNEL_B);
+    Channel* z = getChannel(CHANNEL_Z);
+    Vector3 eye = m_camera.getTranslation();
+    bool gouraud = m_shadingMode == ShadingMode::Gouraud && m_mesh.hasNormals();
+
+    int tilesX = (m_width + RAY_TILE_SIZE - 1) / RAY_TILE_SIZE;
+    int tilesY = (m_height + RAY_TILE_SIZE - 1) / RAY_TILE_SIZE;
+    int tileCount = tilesX * tilesY;
+
+    // Tiles are handed out one at a time, since their cost varies with what they cover
+    std::atomic<int> nextTile = 0;
+    std::atomic<int> hitCount = 0;
+    parallelFor(getThreadCount(), 1, [&](size_t, size_t)
+    {
+        StandardShader shader;
+        shader.viewPosition = eye;
+        shader.lightPosition = m_lightPosition;
+        std::vector<const TracedInstance*> tileInstances;
+        int hits = 0;
+
+        for (int tile = nextTile++; tile < tileCount; tile = nextTile++)
+        {
+            int tileX0 = (tile % tilesX) * RAY_TILE_SIZE;
+            int tileY0 = (tile / tilesX) * RAY_TILE_SIZE;
+            int tileX1 = std::min(tileX0 + RAY_TILE_SIZE, m_width) - 1;
+            int tileY1 = std::min(tileY0 + RAY_TILE_SIZE, m_height) - 1;
+
+            tileInstances.clear();
+            for (const TracedInstance& instance : m_tracedInstances)
+            {
+                if (instance.x0 <= tileX1 && instance.x1 >= tileX0 && instance.y0 <= tileY1 && instance.y1 >= tileY0)
+                {
+                    tileInstances.push_back(&instance);
+                }
+            }
+            if (tileInstances.empty())
+            {
+                continue;
+            }
+
+            for (int y = tileY0; y <= tileY1; y += 2)
+            {
+                for (int x = tileX0; x <= tileX1; x += 2)
+                {
+                    // A 2x2 block of pixels; lanes past the edge of the frame repeat the last
+                    // pixel and are not written
+                    int pixelX[RAY_PACKET_SIZE];
+                    int pixelY[RAY_PACKET_SIZE];
+                    Ray worldRays[RAY_PACKET_SIZE];
+                    for (size_t k = 0; k < RAY_PACKET_SIZE; k++)
+                    {
+                        pixelX[k] = std::min(x + (int) (k & 1), m_width - 1);
+                        pixelY[k] = std::min(y + (int) (k >> 1), m_height - 1);
+                        worldRays[k] = screenToRay(pixelX[k], pixelY[k]);
+                    }
+
+                    // Directions are not renormalized between spaces, so distances found in one
+                    // instance bound the search in the next
+                    RayHit closest[RAY_PACKET_SIZE];
+                    const TracedInstance* closestInstance[RAY_PACKET_SIZE] = {};
+                    for (const TracedInstance* instance : tileInstances)
+                    {
+                        if (instance->x0 > x + 1 || instance->x1 < x || instance->y0 > y + 1 || instance->y1 < y)
+                        {
+                            continue;
+                        }
+
+                        RayPacket packet;
+                        for (size_t k = 0; k < RAY_PACKET_SIZE; k++)
+                        {
+                            packet.rays[k] = worldRays[k].transformed(instance->inverse);
+                            packet.rays[k].tMax = closest[k].t;
+                        }
+                        bvh.intersect(packet);
+                        for (size_t k = 0; k < RAY_PACKET_SIZE; k++)
+                        {
+                            if (packet.hits[k].isHit())
+                            {
+                                closest[k] = packet.hits[k];
+                                closestInstance[k] = instance;
+                            }
+                        }
+                    }
+
+                    for (size_t k = 0; k < RAY_PACKET_SIZE; k++)
+                    {
+                        bool duplicate = (k & 1 && x + 1 >= m_width) || (k >> 1 && y + 1 >= m_height);
+                        if (duplicate || !closest[k].isHit())
+                        {
+                            continue;
+                        }
+
+                        // Same depth as the rasterizer stores
+                        Vector3 position = worldRays[k].at(closest[k].t);
+                        Vector4 ndc = m_mvp * Vector4(position, 1.0);
+                        double depth = 1.0 / ndc._z;
+                        if (depth < m_camera.getNearClip() || depth > m_camera.getFarClip())
+                        {
+                            continue;
+                        }
+
+                        uint32 triangle = closest[k].triangle;
+                        Vector3 normal;
+                        if (gouraud)
+                        {
+                            // Interpolate the vertex normals and light the hit point itself
+                            const uint32* corners = &m_mesh.indices[(size_t) triangle * 3];
+                            double u = closest[k].u;
+                            double v = closest[k].v;
+                            normal = m_mesh.getNormal(corners[0]) * (1.0 - u - v) +
+                                     m_mesh.getNormal(corners[1]) * u + m_mesh.getNormal(corners[2]) * v;
+                        }
+                        else
+                        {
+                            normal = m_mesh.getFaceNormal(triangle);
+                        }
+                        normal = closestInstance[k]->normalMatrix * normal;
+                        normal.normalize();
+                        bool shadowed = m_shadowsActive && isShadowed(position, normal);
+                        Vector3 color = shader.shade(position, normal, shadowed);
+
+                        int pixelOffset = pixelY[k] * m_width + pixelX[k];
+                        z->setPixel(pixelOffset, depth);
+                        r->setPixel(pixelOffset, color._x);
+                        g->setPixel(pixelOffset, color._y);
+                        b->setPixel(pixelOffset, color._z);
+                        if (m_idChannel != nullptr)
+                        {
+                            m_idChannel->setPixel(pixelX[k], pixelY[k], closestInstance[k]->object * PIXEL_ID_OBJECT_SCALE + m_mesh.getSourceTriangle(triangle));
+                        }
+                        hits++;
+                    }
+                }
+            }
+        }
+
+        hitCount += hits;
+    });
+
+    return hitCount;
+}
+
+void Framebuffer::gatherShadowCasters()
+{
+    m_shadowCasters.clear();
+    size_t count = m_instances.empty() ? 1 : m_instances.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        Matrix4 model = m_instances.empty() ? m_model : m_model * m_instances[i];
+        ShadowCaster caster;
+        double determinant = 0.0;
+        caster.inverse = Matrix4(model).getInverse(&determinant);
+        if (determinant != 0.0)
+        {
+            caster.bounds = m_mesh.bounds.transformed(model);
+            m_shadowCasters.push_back(caster);
+        }
+    }
+}
+
+bool Framebuffer::isShadowed(const Vector3& position, const Vector3& normal) const
+{
+    if (m_shadowMode == ShadowMode::Mapped)
+    {
+        return m_shadowMap.isShadowed(position, normal);
+    }
+
+    if (dot(normal, m_lightPosition - position) <= 0.0)
+    {
+        return false;
+    }
+
+    // Start off the surface so the ray doesn't hit the triangle it leaves. The direction runs all
+    // the way to the light, so the light is at t = 1 in every space.
+    Ray ray;
+    ray.origin = position + normal * m_shadowBias;
+    ray.direction = m_lightPosition - ray.origin;
+    ray.tMax = 1.0;
+    for (const ShadowCaster& caster : m_shadowCasters)
+    {
+        double enter = 0.0;
+        if (ray.intersects(caster.bounds, enter) && m_mesh.bvh->occluded(ray.transformed(caster.inverse)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 void Framebuffer::render()
 {
     m_channels[CHANNEL_R]->fill(0.0);
@@ -355,6 +907,10 @@ void Framebuffer::render()
 
     // Reset z-buffer
     m_channels[CHANNEL_Z]->fill(m_camera.getFarClip());
+    if (m_idChannel != nullptr)
+    {
+        m_idChannel->fill(-1.0);
+    }
 
     //Pre-compute the view/projection only once per frame, rather than for every vertex
     m_view = lookAt(m_camera.getTranslation(), m_camera.getTarget(), Vector3::up());  // View matrix
@@ -363,19 +919,99 @@ void Framebuffer::render()
     // Update MVP matrix
     m_mvp = m_proj * m_view;
 
-    // Draw geometry
+    // Shadows come from every instance, including those out of view
+    m_shadowCasters.clear();
+    m_shadowMapRedrawn = false;
+    if (m_shadowMode == ShadowMode::RayTraced && m_mesh.hasBvh())
+    {
+        m_shadowBias = SHADOW_RAY_BIAS * m_mesh.bounds.getSize().length();
+        gatherShadowCasters();
+        m_shadowsActive = !m_shadowCasters.empty();
+    }
+    else if (m_shadowMode == ShadowMode::Mapped)
+    {
+        // The map is kept from earlier frames while the light and the instances stay put
+        m_shadowModels.clear();
+        if (m_instances.empty())
+        {
+            m_shadowModels.push_back(m_model);
+        }
+        for (const Matrix4& instance : m_instances)
+        {
+            m_shadowModels.push_back(m_model * instance);
+        }
+        m_shadowMapRedrawn = m_shadowMap.update(m_lightPosition, m_mesh, m_shadowModels);
+        m_shadowsActive = !m_shadowMap.empty();
+    }
+    else
+    {
+        m_shadowsActive = false;
+    }
+
+    // Trace the bound mesh when that is expected to be cheaper than rasterizing it
+    m_rayTraced = false;
+    if (m_renderMode != RenderMode::Rasterize && m_mesh.hasBvh())
+    {
+        gatherTracedInstances();
+        m_rayTraced = m_renderMode == RenderMode::RayTrace || shouldRayTrace();
+    }
+
+    // Draw the bound mesh once per instance, or once on its own
     int count = 0;
-    for (auto t : m_triangles)
+    m_occludedCount = 0;
+    if (m_rayTraced)
+    {
+        count += traceMesh();
+    }
+    else if (m_instances.empty())
     {
-        if (drawTriangle(t))
+        count += drawMesh(m_model, 0);
+    }
+    else
+    {
+        // Instances are tested with bounds around both the mesh and its occluder, so the
+        // occluder can't hide the instance it was drawn for
+        bool occlusionCulling = m_occlusionCulling && m_occluder.numTriangles() > 0;
+        BoundingBox bounds = m_mesh.bounds;
+        if (occlusionCulling)
         {
-            count++;
+            bounds.expand(m_occluder.bounds);
+            drawOccluders();
         }
-        else
+
+        for (size_t i = 0; i < m_instances.size(); i++)
         {
-            continue;
+            Matrix4 model = m_model * m_instances[i];
+            if (occlusionCulling && m_occlusionBuffer.isOccluded(bounds, model))
+            {
+                m_occludedCount++;
+                continue;
+            }
+            count += drawMesh(model, (uint32) i);
         }
     }
+
+    // Draw whatever has been streamed in so far
+    Vector3 eye = m_camera.getTranslation();
+    if (m_triangleStream != nullptr)
+    {
+        m_triangleStream->forEachPublished([&](const float* p)
+        {
+            Vector3 v1(p[0], p[1], p[2]);
+            Vector3 v2(p[3], p[4], p[5]);
+            Vector3 v3(p[6], p[7], p[8]);
+            Vector3 normal(p[9], p[10], p[11]);
+            if (m_cullBackfaces && dot(normal, eye - v1) <= 0.0)
+            {
+                return;
+            }
+
+            if (drawTriangle(v1, v2, v3, normal))
+            {
+                count++;
+            }
+        });
+    }
 }
 
 
@@ -9,16 +9,63 @@
 #include <sstream>
 #include <map>
 
+#include "bvh.h"
 #include "camera.h"
 #include "channel.h"
 #include "color.h"
+#include "frustum.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "occlusionbuffer.h"
 #include "printbuffer.h"
 #include "shader.h"
+#include "shadowmap.h"
+#include "trianglestream.h"
 
 namespace Graphics
 {
+    constexpr uint32 PIXEL_NO_ID = UINT32_MAX;
+
+    /// <summary>
+    /// What was drawn at a pixel: the index of the instance, 0 for a mesh drawn on its own, and
+    /// of the triangle within the bound mesh. For a simplified level the triangle is its source
+    /// in the full mesh, see MeshView::getSourceTriangle(). Both are PIXEL_NO_ID where nothing
+    /// with an ID was drawn, such as the background or streamed triangles.
+    /// </summary>
+    struct PixelId
+    {
+        uint32 object = PIXEL_NO_ID;
+        uint32 triangle = PIXEL_NO_ID;
+
+        bool isValid() const
+        {
+            return triangle != PIXEL_NO_ID;
+        }
+    };
+
+    /// <summary>
+    /// How render() turns the bound mesh into pixels.
+    /// </summary>
+    enum class RenderMode
+    {
+        Rasterize,      // Project and fill each triangle
+        RayTrace,       // Trace a ray per pixel through the mesh's BVH
+        Automatic       // Whichever is estimated to be faster for the current view
+    };
+
+    /// <summary>
+    /// How shadows from the bound mesh are found.
+    /// </summary>
+    enum class ShadowMode
+    {
+        Off,
+        RayTraced,      // A ray to the light per lit pixel, through the mesh's BVH
+        Mapped          // A depth map rendered from the light, redrawn only when something moves
+    };
+
+    constexpr int RAY_TILE_SIZE = 16;           // Pixels per side of the tiles threads trace at a time
+    constexpr double RAY_STEP_COST = 0.25;      // Cost of one BVH level for one ray, relative to one rasterized triangle
+    constexpr double SHADOW_RAY_BIAS = 1e-3;    // Shadow rays start this far off the surface, relative to the mesh's size
 
 /**
  * @brief Main class for managing displaying to the screen.
@@ -34,6 +81,7 @@ namespace Graphics
 
         // Channels
         std::map<const char*, Channel*> m_channels;
+        Channel* m_idChannel = nullptr;            // Also in m_channels while enabled
 
         // Pixel memory
         SIZE_T m_bufferSize = 0;
@@ -42,7 +90,56 @@ namespace Graphics
         const int m_bytesPerPixel = 4;
 
         // Vertex memory
-        std::vector<Triangle*> m_triangles;
+        MeshView m_mesh;
+        TriangleStream* m_triangleStream = nullptr;
+        bool m_cullBackfaces = true;
+        ShadingMode m_shadingMode = ShadingMode::Flat;
+        std::vector<Vector3> m_vertexColors;       // Per-vertex lighting of the instance being drawn, for Gouraud shading
+
+        // Instances of the bound mesh
+        std::span<const Matrix4> m_instances;
+        std::vector<float> m_instancePositions;    // World-space positions of the instance being drawn
+        std::vector<uint32> m_drawTriangles;       // Triangles of the instance being drawn left after culling
+        std::vector<uint32> m_drawVertices;        // The vertices those triangles use, each once
+        std::vector<uint32> m_vertexStamps;        // Per vertex, the last draw that gathered it
+        uint32 m_drawStamp = 0;
+
+        // Occlusion culling of instances
+        MeshView m_occluder;
+        double m_occluderError = 0.0;              // Object space, see bindOccluder()
+        bool m_occlusionCulling = true;
+        OcclusionBuffer m_occlusionBuffer;
+        std::vector<std::pair<double, size_t>> m_occluderOrder;     // View depth and index of instances in view
+        int m_occludedCount = 0;
+
+        // Ray tracing
+        struct TracedInstance
+        {
+            Matrix4 inverse;                        // World to mesh space
+            Matrix4 normalMatrix;                   // Mesh to world space, for normals
+            int x0, y0, x1, y1;                     // Pixels its bounds may cover, inclusive
+            uint32 object;
+        };
+        RenderMode m_renderMode = RenderMode::Automatic;
+        bool m_rayTraced = false;
+        std::vector<TracedInstance> m_tracedInstances;
+
+        // Lighting, in world space
+        Vector3 m_lightPosition = StandardShader().lightPosition;
+
+        // Shadows
+        struct ShadowCaster
+        {
+            Matrix4 inverse;                        // World to mesh space
+            BoundingBox bounds;                     // World space
+        };
+        ShadowMode m_shadowMode = ShadowMode::Off;
+        bool m_shadowsActive = false;               // Whether this frame has anything to look shadows up in
+        std::vector<ShadowCaster> m_shadowCasters;
+        double m_shadowBias = 0.0;
+        ShadowMap m_shadowMap;
+        std::vector<Matrix4> m_shadowModels;
+        bool m_shadowMapRedrawn = false;
 
         // Camera and matrices
         Camera m_camera;
@@ -121,6 +218,19 @@ namespace Graphics
             return m_channels[channel];
         }
 
+        /// <summary>
+        /// Sets whether the raster loop records a PixelId for every pixel it draws, in the
+        /// CHANNEL_ID channel. It costs one more write per drawn pixel.
+        /// </summary>
+        void setIdChannel(bool enabled);
+
+        /// <summary>
+        /// Returns what the last render() drew at the given pixel. It is a single read of the ID
+        /// channel, so it is cheap enough to call every frame for hover feedback. Nothing is
+        /// returned while the ID channel is disabled.
+        /// </summary>
+        PixelId pick(int x, int y);
+
         // Camera
         Camera* getCamera()
         {
@@ -139,7 +249,137 @@ namespace Graphics
         }
 
         HBITMAP getBitmap();
-        void bindTriangleBuffer(std::vector<Triangle*> data);
+
+        /// <summary>
+        /// Binds the mesh streams drawn by render(). Nothing is copied; the mesh must outlive the
+        /// binding. Bind an empty view to unbind.
+        /// </summary>
+        void bindMesh(const MeshView& mesh)
+        {
+            m_mesh = mesh;
+        }
+
+        /// <summary>
+        /// Binds one transform per instance of the bound mesh. render() then draws the mesh once
+        /// per matrix, each combined with the model matrix, instead of once with the model matrix
+        /// alone. Nothing is copied; the matrices must outlive the binding. Bind an empty span to
+        /// unbind.
+        /// </summary>
+        void bindInstances(std::span<const Matrix4> instances)
+        {
+            m_instances = instances;
+        }
+
+        /// <summary>
+        /// Binds a cheap stand-in for the bound mesh, such as a simplified level of detail, that
+        /// the nearest instances are drawn with into the occlusion buffer. Its triangles should be
+        /// large, since only pixels a single triangle covers whole count. It is drawn shrunk by
+        /// its error, so where it bulges past the mesh nothing behind is lost; the larger the
+        /// error, the less it hides. Nothing is copied. Bind an empty view to unbind.
+        /// </summary>
+        /// <param name="error">How far, in object space, the occluder may stray from the mesh.</param>
+        void bindOccluder(const MeshView& occluder, double error = 0.0)
+        {
+            m_occluder = occluder;
+            m_occluderError = error;
+        }
+
+        /// <summary>
+        /// Sets whether instances hidden behind the nearest ones are skipped before their
+        /// triangles are drawn. It needs instances and an occluder to be bound.
+        /// </summary>
+        void setOcclusionCulling(bool enabled)
+        {
+            m_occlusionCulling = enabled;
+        }
+
+        /// <summary>
+        /// Returns how many instances the last render() skipped as occluded.
+        /// </summary>
+        int getOccludedCount()
+        {
+            return m_occludedCount;
+        }
+
+        const OcclusionBuffer& getOcclusionBuffer()
+        {
+            return m_occlusionBuffer;
+        }
+
+        /// <summary>
+        /// Sets how the bound mesh is drawn. Ray tracing needs the mesh's BVH; without one it is
+        /// always rasterized. Streamed triangles are always rasterized.
+        /// </summary>
+        void setRenderMode(RenderMode mode)
+        {
+            m_renderMode = mode;
+        }
+
+        /// <summary>
+        /// Sets the world-space position of the point light every shader lights the scene with
+        /// and shadows are cast from. Moving it redraws the shadow map.
+        /// </summary>
+        void setLightPosition(const Vector3& position)
+        {
+            m_lightPosition = position;
+        }
+        const Vector3& getLightPosition()
+        {
+            return m_lightPosition;
+        }
+
+        /// <summary>
+        /// Sets how pixels lit by the light find whether the bound mesh, or any instance of it,
+        /// shadows them; shadowed pixels only get ambient light. Ray traced shadows need the
+        /// mesh's BVH. Streamed triangles cast no shadows.
+        /// </summary>
+        void setShadowMode(ShadowMode mode)
+        {
+            m_shadowMode = mode;
+        }
+
+        /// <summary>
+        /// Returns whether the last render() had to redraw the shadow map, rather than reuse it.
+        /// </summary>
+        bool wasShadowMapRedrawn()
+        {
+            return m_shadowMapRedrawn;
+        }
+
+        /// <summary>
+        /// Returns whether the last render() ray traced the bound mesh.
+        /// </summary>
+        bool isRayTraced()
+        {
+            return m_rayTraced;
+        }
+
+        /// <summary>
+        /// Sets whether triangles facing away from the camera are skipped before rasterizing. This
+        /// also culls meshlets whose triangles all face away.
+        /// </summary>
+        void setBackfaceCulling(bool enabled)
+        {
+            m_cullBackfaces = enabled;
+        }
+
+        /// <summary>
+        /// Sets where lighting is evaluated. Gouraud shading needs vertex normals; meshes without
+        /// them are drawn flat.
+        /// </summary>
+        void setShadingMode(ShadingMode mode)
+        {
+            m_shadingMode = mode;
+        }
+
+        /// <summary>
+        /// Binds a stream that is still being filled by a loader. Each render draws whatever part of
+        /// it has been published, after the bound mesh. Pass nullptr to unbind.
+        /// </summary>
+        void bindTriangleStream(TriangleStream* stream)
+        {
+            m_triangleStream = stream;
+        }
 
         //void setPixelShader(PixelShader* shader) { m_pixelShader = shader; }
 
@@ -149,10 +389,11 @@ namespace Graphics
         }
 
         /// <summary>
-        /// Sets the current model matrix to the given matrix.
+        /// Sets the current model matrix to the given matrix. It places the bound mesh, or every
+        /// bound instance, in the world; streamed triangles are already in world space.
         /// </summary>
         /// <param name="m">The new matrix to set the model to.</param>
-        void setModelMatrix(Matrix4& m)
+        void setModelMatrix(const Matrix4& m)
         {
             m_model = m;
         }
@@ -197,6 +438,15 @@ namespace Graphics
         /// <param name="z">The world depth to project.</param>
         Vector3 screenToWorld(double x, double y, double z);
 
+        /// <summary>
+        /// Returns the world-space ray from the camera through the point the given pixel is
+        /// sampled at. This assumes the MVP matrix has already been computed.
+        /// </summary>
+        /// <param name="x">The X screen coordinate.</param>
+        /// <param name="y">The Y screen coordinate.</param>
+        /// <returns>A ray with a unit-length direction.</returns>
+        Ray screenToRay(double x, double y);
+
         /// <summary>
         /// Given a triangle and a screen-space point on the triangle, returns the z-depth
         /// of said point.
@@ -218,17 +468,6 @@ namespace Graphics
         /// </summary>
         Rect<int> getBoundingBox(Vector3* v1, Vector3* v2, Vector3* v3);
 
-        /// <summary>
-        /// Returns the bounding box of the given triangle.
-        /// </summary>
-        Rect<int> getBoundingBox(Triangle* t)
-        {
-            Vector3 v1 = t->v1()->getTranslation();
-            Vector3 v2 = t->v2()->getTranslation();
-            Vector3 v3 = t->v3()->getTranslation();
-            return getBoundingBox(&v1, &v2, &v3);
-        };
-
         /// <summary>
         /// Based on Bresenham�s Line Drawing Algorithm.
         /// </summary>
@@ -248,16 +487,30 @@ namespace Graphics
         /// <summary>
         /// Renders the given triangle, through its world-space vertices, to the RGB/Z buffer(s).
         /// </summary>
-        /// <param name="triangle">The triangle to draw.</param>
+        /// <param name="v1">First world-space corner of the triangle.</param>
+        /// <param name="v2">Second world-space corner of the triangle.</param>
+        /// <param name="v3">Third world-space corner of the triangle.</param>
+        /// <param name="worldNormal">The unit-length world-space normal of the triangle.</param>
+        /// <param name="colors">Optional lit colors of the three corners. When given, they are
+        /// interpolated instead of running the fragment shader per pixel.</param>
+        /// <param name="id">What the triangle is, recorded in the ID channel when enabled.</param>
         /// <returns>Whether the triangle was drawn on the buffer (screen) or not.</returns>
-        bool drawTriangle(Triangle* triangle);
+        bool drawTriangle(Vector3 v1, Vector3 v2, Vector3 v3, Vector3 worldNormal, const Vector3* colors = nullptr,
+                          PixelId id = PixelId());
 
         /// <summary>
         /// Renders all triangles in the scene (triangle buffer).
         /// 1. Clear all channels of memory.
         /// 2. Set Z channel to be filled with the camera's far clip value.
         /// 3. Construct the MVP matrix, given the current camera orientation.
-        /// 4. Draw each triangle to the RGB/Z buffers.
+        /// 4. Decide whether to ray trace or rasterize the bound mesh.
+        /// 5. When ray tracing, trace the mesh and its instances a tile of pixels at a time.
+        /// 6. Otherwise, with occlusion culling, draw the occluder of the nearest instances into
+        ///    the low resolution occlusion buffer.
+        /// 7. For the mesh or each instance of it, skip it entirely if it is outside the view
+        ///    frustum or occluded, then skip meshlets outside the frustum or facing away from the
+        ///    camera.
+        /// 8. Draw each remaining triangle to the RGB/Z buffers.
         /// </summary>
         void render();
 
@@ -282,6 +535,49 @@ namespace Graphics
         /// </summary>
         void allocateDisplayPtr();
 
+     private:
+        /// <summary>
+        /// Draws the bound mesh once with the given model matrix.
+        /// </summary>
+        /// <param name="object">The object index recorded in the ID channel.</param>
+        /// <returns>The number of triangles drawn.</returns>
+        int drawMesh(const Matrix4& model, uint32 object);
+
+        /// <summary>
+        /// Fills the occlusion buffer with the occluder of the instances nearest the camera.
+        /// </summary>
+        void drawOccluders();
+
+        /// <summary>
+        /// Collects the instances in view, with the screen rectangles their bounds cover.
+        /// </summary>
+        void gatherTracedInstances();
+
+        /// <summary>
+        /// Estimates whether tracing the gathered instances is cheaper than rasterizing them.
+        /// Rasterizing costs about the same for every triangle, tracing grows with the pixels
+        /// covered and only logarithmically with the triangles.
+        /// </summary>
+        bool shouldRayTrace();
+
+        /// <summary>
+        /// Ray traces the gathered instances into the RGB/Z buffers, with tiles of pixels spread
+        /// across threads and 2x2 blocks of pixels traced as packets.
+        /// </summary>
+        /// <returns>The number of pixels hit.</returns>
+        int traceMesh();
+
+        /// <summary>
+        /// Collects the bound mesh's instances, in view or not, as shadow casters.
+        /// </summary>
+        void gatherShadowCasters();
+
+        /// <summary>
+        /// Returns whether anything lies between the given surface point and the light, by the
+        /// current shadow mode. Surfaces facing away from the light are never reported as
+        /// shadowed; they are unlit anyway.
+        /// </summary>
+        bool isShadowed(const Vector3& position, const Vector3& normal) const;
     };
 
 }
@@ -0,0 +1,104 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <array>
+
+#include "boundingbox.h"
+#include "matrix.h"
+#include "vector.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+constexpr size_t FRUSTUM_PLANE_COUNT = 6;
+
+/// <summary>
+/// The volume a camera can see, as planes (nx, ny, nz, d) with unit normals pointing inwards; a
+/// point p is inside a plane when dot(n, p) + d >= 0. A default constructed frustum contains
+/// everything.
+/// </summary>
+class Frustum
+{
+public:
+	Frustum() { };
+
+	/// <summary>
+	/// Extracts the planes from a combined projection * view matrix (Gribb and Hartmann). The
+	/// projection from Camera::getProjectionMatrix gives points in front of the camera a negative
+	/// w, equal to minus their view depth, so the sides are |x| <= -w and |y| <= -w. Its z row
+	/// doesn't map the clip range to [-1, 1], so near and far are taken from w directly.
+	/// </summary>
+	/// <param name="viewProj">The projection matrix times the view matrix.</param>
+	/// <param name="farClip">The distance along the view direction past which nothing is seen.</param>
+	Frustum(const Matrix4& viewProj, double farClip)
+	{
+		auto row = [&](int i)
+		{
+			return Vector4(viewProj[i][0], viewProj[i][1], viewProj[i][2], viewProj[i][3]);
+		};
+		Vector4 x = row(0);
+		Vector4 y = row(1);
+		Vector4 w = row(3);
+
+		setPlane(0, -w._x - x._x, -w._y - x._y, -w._z - x._z, -w._w - x._w);    // Left/right
+		setPlane(1, -w._x + x._x, -w._y + x._y, -w._z + x._z, -w._w + x._w);
+		setPlane(2, -w._x - y._x, -w._y - y._y, -w._z - y._z, -w._w - y._w);    // Bottom/top
+		setPlane(3, -w._x + y._x, -w._y + y._y, -w._z + y._z, -w._w + y._w);
+		setPlane(4, -w._x, -w._y, -w._z, -w._w);                                // Near, at the eye
+		setPlane(5, w._x, w._y, w._z, w._w + farClip);                          // Far
+	}
+
+	const Vector4& getPlane(size_t i) const { return m_planes[i]; }
+
+	/// <summary>
+	/// Returns whether any part of the given sphere may be inside the frustum.
+	/// </summary>
+	bool intersectsSphere(const Vector3& center, double radius) const
+	{
+		for (const Vector4& plane : m_planes)
+		{
+			if (plane._x * center._x + plane._y * center._y + plane._z * center._z + plane._w < -radius)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Returns whether any part of the given box may be inside the frustum. Each plane is tested
+	/// against the box corner furthest along its normal.
+	/// </summary>
+	bool intersectsBox(const BoundingBox& box) const
+	{
+		const Vector3& min = box.getMin();
+		const Vector3& max = box.getMax();
+		for (const Vector4& plane : m_planes)
+		{
+			double x = plane._x >= 0.0 ? max._x : min._x;
+			double y = plane._y >= 0.0 ? max._y : min._y;
+			double z = plane._z >= 0.0 ? max._z : min._z;
+			if (plane._x * x + plane._y * y + plane._z * z + plane._w < 0.0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	void setPlane(size_t i, double x, double y, double z, double d)
+	{
+		double length = sqrt(x * x + y * y + z * z);
+		if (length > 0.0)
+		{
+			m_planes[i] = Vector4(x / length, y / length, z / length, d / length);
+		}
+	}
+
+	std::array<Vector4, FRUSTUM_PLANE_COUNT> m_planes;
+};
+
+}
+
+#endif
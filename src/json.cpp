@@ -0,0 +1,393 @@
+#include <charconv>
+#include <cstring>
+
+#include "json.h"
+
+namespace Graphics {
+namespace JSON {
+
+constexpr int JSON_MAX_DEPTH = 512;    // Deeper documents are rejected rather than overflowing the stack
+
+const JsonNode* JsonValue::getNode() const
+{
+    return m_document ? &m_document->m_nodes[m_index] : nullptr;
+}
+
+std::string_view JsonValue::asString() const
+{
+    return isString() ? m_document->getText(getNode()->range.offset, getNode()->range.count) : std::string_view();
+}
+
+std::string_view JsonValue::getKey() const
+{
+    return m_document ? m_document->getText(getNode()->keyOffset, getNode()->keyLength) : std::string_view();
+}
+
+size_t JsonValue::size() const
+{
+    return isArray() || isObject() ? getNode()->range.count : 0;
+}
+
+JsonValue JsonValue::operator[](size_t index) const
+{
+    if (index >= size())
+    {
+        return JsonValue();
+    }
+    return JsonValue(m_document, m_document->m_children[getNode()->range.offset + index]);
+}
+
+JsonValue JsonValue::operator[](std::string_view key) const
+{
+    if (!isObject())
+    {
+        return JsonValue();
+    }
+
+    const JsonNode* node = getNode();
+    const uint32_t* children = m_document->m_children.data() + node->range.offset;
+    for (uint32_t i = 0; i < node->range.count; i++)
+    {
+        const JsonNode& child = m_document->m_nodes[children[i]];
+        if (m_document->getText(child.keyOffset, child.keyLength) == key)
+        {
+            return JsonValue(m_document, children[i]);
+        }
+    }
+    return JsonValue();
+}
+
+/// <summary>
+/// Single-pass recursive descent parser. Every value becomes one node in the document's node arena.
+/// While a container is open its child indices are collected on a shared stack, then moved into the
+/// child arena in one block when the container closes.
+/// </summary>
+class JsonParser
+{
+    const char* m_begin;
+    const char* m_ptr;
+    const char* m_end;
+
+    std::vector<JsonNode>& m_nodes;
+    std::vector<uint32_t>& m_children;
+    std::vector<uint32_t> m_stack;
+
+public:
+    JsonParser(std::string_view text, JsonDocument& document)
+        : m_begin(text.data()),
+          m_ptr(text.data()),
+          m_end(text.data() + text.size()),
+          m_nodes(document.m_nodes),
+          m_children(document.m_children)
+    {
+        if (text.size() > UINT32_MAX)
+        {
+            throw std::runtime_error("Invalid JSON: Documents are limited to 4 GB");
+        }
+
+        // Number-heavy glTF averages about one node every 8 bytes; reserving for that up front keeps
+        // regrowth of the arenas rare
+        m_nodes.reserve(text.size() / 8 + 1);
+        m_children.reserve(text.size() / 8 + 1);
+    };
+
+    void parseDocument()
+    {
+        parseValue(0);
+        skipWhitespace();
+        if (m_ptr != m_end)
+        {
+            error("Unexpected data after the root value");
+        }
+    }
+
+private:
+    [[noreturn]] void error(const char* message)
+    {
+        throw std::runtime_error(std::string("Invalid JSON: ") + message + " at offset " + std::to_string(m_ptr - m_begin));
+    }
+
+    void skipWhitespace()
+    {
+        while (m_ptr < m_end && (*m_ptr == ' ' || *m_ptr == '\n' || *m_ptr == '\r' || *m_ptr == '\t'))
+        {
+            m_ptr++;
+        }
+    }
+
+    void expect(char c)
+    {
+        skipWhitespace();
+        if (m_ptr == m_end || *m_ptr != c)
+        {
+            error("Unexpected character");
+        }
+        m_ptr++;
+    }
+
+    bool consume(char c)
+    {
+        skipWhitespace();
+        if (m_ptr < m_end && *m_ptr == c)
+        {
+            m_ptr++;
+            return true;
+        }
+        return false;
+    }
+
+    bool consume(std::string_view literal)
+    {
+        if ((size_t) (m_end - m_ptr) >= literal.size() && memcmp(m_ptr, literal.data(), literal.size()) == 0)
+        {
+            m_ptr += literal.size();
+            return true;
+        }
+        return false;
+    }
+
+    uint32_t getOffset(std::string_view string) const
+    {
+        return (uint32_t) (string.data() - m_begin);
+    }
+
+    std::string_view parseString()
+    {
+        expect('"');
+        const char* start = m_ptr;
+        while (true)
+        {
+            auto quote = (const char*) memchr(m_ptr, '"', m_end - m_ptr);
+            if (quote == nullptr)
+            {
+                error("Unterminated string");
+            }
+
+            // The quote is escaped if it follows an odd number of backslashes
+            const char* backslash = quote;
+            while (backslash > start && backslash[-1] == '\\')
+            {
+                backslash--;
+            }
+            m_ptr = quote + 1;
+            if ((quote - backslash) % 2 == 0)
+            {
+                return std::string_view(start, quote - start);
+            }
+        }
+    }
+
+    void closeContainer(uint32_t index, size_t stackBase)
+    {
+        JsonNode& node = m_nodes[index];
+        node.range.offset = (uint32_t) m_children.size();
+        node.range.count = (uint32_t) (m_stack.size() - stackBase);
+        m_children.insert(m_children.end(), m_stack.begin() + (std::ptrdiff_t) stackBase, m_stack.end());
+        m_stack.resize(stackBase);
+    }
+
+    uint32_t parseValue(int depth)
+    {
+        if (depth > JSON_MAX_DEPTH)
+        {
+            error("Document is nested too deeply");
+        }
+
+        skipWhitespace();
+        if (m_ptr == m_end)
+        {
+            error("Unexpected end of input");
+        }
+
+        auto index = (uint32_t) m_nodes.size();
+        m_nodes.emplace_back();
+
+        switch (*m_ptr)
+        {
+        case '{':
+        {
+            m_nodes[index].type = JsonType::Object;
+            m_ptr++;
+            size_t stackBase = m_stack.size();
+            if (!consume('}'))
+            {
+                do
+                {
+                    std::string_view key = parseString();
+                    expect(':');
+                    uint32_t child = parseValue(depth + 1);
+                    m_nodes[child].keyOffset = getOffset(key);
+                    m_nodes[child].keyLength = (uint32_t) key.size();
+                    m_stack.push_back(child);
+                } while (consume(','));
+                expect('}');
+            }
+            closeContainer(index, stackBase);
+            break;
+        }
+        case '[':
+        {
+            m_nodes[index].type = JsonType::Array;
+            m_ptr++;
+            size_t stackBase = m_stack.size();
+            if (!consume(']'))
+            {
+                do
+                {
+                    uint32_t child = parseValue(depth + 1);
+                    m_stack.push_back(child);
+                } while (consume(','));
+                expect(']');
+            }
+            closeContainer(index, stackBase);
+            break;
+        }
+        case '"':
+        {
+            std::string_view string = parseString();
+            m_nodes[index].type = JsonType::String;
+            m_nodes[index].range.offset = getOffset(string);
+            m_nodes[index].range.count = (uint32_t) string.size();
+            break;
+        }
+        case 't':
+        case 'f':
+        {
+            m_nodes[index].type = JsonType::Bool;
+            if (consume("true"))
+            {
+                m_nodes[index].boolean = true;
+            }
+            else if (!consume("false"))
+            {
+                error("Invalid literal");
+            }
+            break;
+        }
+        case 'n':
+        {
+            if (!consume("null"))
+            {
+                error("Invalid literal");
+            }
+            break;
+        }
+        default:
+        {
+            double number = 0.0;
+            auto [next, ec] = std::from_chars(m_ptr, m_end, number);
+            if (ec != std::errc())
+            {
+                error("Invalid number");
+            }
+            m_ptr = next;
+            m_nodes[index].type = JsonType::Number;
+            m_nodes[index].number = number;
+            break;
+        }
+        }
+
+        return index;
+    }
+};
+
+JsonDocument::JsonDocument(std::string_view text)
+    : m_source(text)
+{
+    JsonParser(text, *this).parseDocument();
+}
+
+JsonDocument loadString(std::string_view text)
+{
+    return JsonDocument(text);
+}
+
+static void appendUtf8(std::string& result, uint32_t codepoint)
+{
+    if (codepoint < 0x80)
+    {
+        result += (char) codepoint;
+    }
+    else if (codepoint < 0x800)
+    {
+        result += (char) (0xC0 | (codepoint >> 6));
+        result += (char) (0x80 | (codepoint & 0x3F));
+    }
+    else if (codepoint < 0x10000)
+    {
+        result += (char) (0xE0 | (codepoint >> 12));
+        result += (char) (0x80 | ((codepoint >> 6) & 0x3F));
+        result += (char) (0x80 | (codepoint & 0x3F));
+    }
+    else
+    {
+        result += (char) (0xF0 | (codepoint >> 18));
+        result += (char) (0x80 | ((codepoint >> 12) & 0x3F));
+        result += (char) (0x80 | ((codepoint >> 6) & 0x3F));
+        result += (char) (0x80 | (codepoint & 0x3F));
+    }
+}
+
+static bool parseHex(std::string_view string, size_t offset, uint32_t* value)
+{
+    if (offset + 4 > string.size())
+    {
+        return false;
+    }
+    auto [next, ec] = std::from_chars(string.data() + offset, string.data() + offset + 4, *value, 16);
+    return ec == std::errc() && next == string.data() + offset + 4;
+}
+
+std::string unescape(std::string_view string)
+{
+    std::string result;
+    result.reserve(string.size());
+
+    for (size_t i = 0; i < string.size(); i++)
+    {
+        if (string[i] != '\\' || i + 1 == string.size())
+        {
+            result += string[i];
+            continue;
+        }
+
+        char c = string[++i];
+        switch (c)
+        {
+        case 'b': result += '\b'; break;
+        case 'f': result += '\f'; break;
+        case 'n': result += '\n'; break;
+        case 'r': result += '\r'; break;
+        case 't': result += '\t'; break;
+        case 'u':
+        {
+            uint32_t codepoint = 0;
+            if (!parseHex(string, i + 1, &codepoint))
+            {
+                throw std::runtime_error("Invalid JSON: Bad unicode escape");
+            }
+            i += 4;
+
+            // Combine a UTF-16 surrogate pair into one codepoint
+            uint32_t low = 0;
+            if (codepoint >= 0xD800 && codepoint < 0xDC00 && i + 2 < string.size() &&
+                string[i + 1] == '\\' && string[i + 2] == 'u' && parseHex(string, i + 3, &low) &&
+                low >= 0xDC00 && low < 0xE000)
+            {
+                codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                i += 6;
+            }
+            appendUtf8(result, codepoint);
+            break;
+        }
+        default:
+            result += c;    // \" \\ and \/
+            break;
+        }
+    }
+
+    return result;
+}
+
+}
+}
@@ -0,0 +1,176 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Graphics {
+namespace JSON {
+
+enum class JsonType : uint8_t
+{
+	Null,
+	Bool,
+	Number,
+	String,
+	Array,
+	Object
+};
+
+/// <summary>
+/// A parsed node, stored in the node arena of its JsonDocument. Strings and keys are stored as
+/// offset/length pairs into the source text. Containers refer to a contiguous run of child node
+/// indices in the document's child arena.
+/// </summary>
+struct JsonNode
+{
+	JsonType type = JsonType::Null;
+	bool boolean = false;
+	uint32_t keyOffset = 0;
+	uint32_t keyLength = 0;
+
+	union
+	{
+		double number = 0.0;
+		struct
+		{
+			uint32_t offset;	// First child, or first character of a string
+			uint32_t count;		// Number of children, or length of a string
+		} range;
+	};
+};
+
+class JsonDocument;
+
+/// <summary>
+/// Lightweight handle to a node of a JsonDocument. Looking up a missing key or index returns a
+/// null value rather than throwing, so lookups can be chained.
+/// </summary>
+class JsonValue
+{
+public:
+	JsonValue() = default;
+	JsonValue(const JsonDocument* document, uint32_t index)
+		: m_document(document), m_index(index) { };
+
+	JsonType getType() const { return getNode() ? getNode()->type : JsonType::Null; }
+	bool isNull() const { return getType() == JsonType::Null; }
+	bool isBool() const { return getType() == JsonType::Bool; }
+	bool isNumber() const { return getType() == JsonType::Number; }
+	bool isString() const { return getType() == JsonType::String; }
+	bool isArray() const { return getType() == JsonType::Array; }
+	bool isObject() const { return getType() == JsonType::Object; }
+
+	bool asBool(bool fallback = false) const { return isBool() ? getNode()->boolean : fallback; }
+	double asNumber(double fallback = 0.0) const { return isNumber() ? getNode()->number : fallback; }
+	int asInt(int fallback = 0) const { return isNumber() ? (int) getNode()->number : fallback; }
+
+	/// <summary>
+	/// Returns the raw string, as it appears between the quotes in the source text.
+	/// Use unescape() if it may contain escape sequences.
+	/// </summary>
+	std::string_view asString() const;
+
+	/// <summary>
+	/// Returns the key of this value within its parent object.
+	/// </summary>
+	std::string_view getKey() const;
+
+	/// <summary>
+	/// Returns the number of elements of an array or members of an object.
+	/// </summary>
+	size_t size() const;
+
+	/// <summary>
+	/// Returns whether this object has a member with the given key.
+	/// </summary>
+	bool has(std::string_view key) const { return isObject() && (*this)[key].m_document != nullptr; }
+
+	/// <summary>
+	/// Returns the array element or object member at the given index, or a null value if out of range.
+	/// </summary>
+	JsonValue operator [] (size_t index) const;
+	JsonValue operator [] (int index) const { return index < 0 ? JsonValue() : (*this)[(size_t) index]; }
+
+	/// <summary>
+	/// Returns the object member with the given key, or a null value if there is none.
+	/// </summary>
+	JsonValue operator [] (std::string_view key) const;
+	JsonValue operator [] (const char* key) const { return (*this)[std::string_view(key)]; }
+
+	/// <summary>
+	/// Iterates over the elements of an array or the members of an object.
+	/// </summary>
+	class Iterator
+	{
+		const JsonValue* m_parent;
+		size_t m_index;
+
+	public:
+		Iterator(const JsonValue* parent, size_t index) : m_parent(parent), m_index(index) { };
+
+		JsonValue operator * () const { return (*m_parent)[m_index]; }
+		Iterator& operator ++ () { m_index++; return *this; }
+		bool operator != (const Iterator& other) const { return m_index != other.m_index; }
+	};
+
+	Iterator begin() const { return Iterator(this, 0); }
+	Iterator end() const { return Iterator(this, size()); }
+
+private:
+	const JsonNode* getNode() const;
+
+	const JsonDocument* m_document = nullptr;
+	uint32_t m_index = 0;
+};
+
+/// <summary>
+/// A parsed JSON document. All nodes live in one arena and all container children in a second
+/// one, so parsing performs no per-node heap allocation. The source text must outlive the document.
+/// </summary>
+class JsonDocument
+{
+public:
+	JsonDocument() = default;
+
+	/// <summary>
+	/// Parses the given JSON text in a single pass. Throws std::runtime_error on malformed input.
+	/// </summary>
+	explicit JsonDocument(std::string_view text);
+
+	JsonValue getRoot() const { return m_nodes.empty() ? JsonValue() : JsonValue(this, 0); }
+	size_t getNodeCount() const { return m_nodes.size(); }
+
+private:
+	friend class JsonValue;
+	friend class JsonParser;
+
+	std::string_view getText(uint32_t offset, uint32_t length) const
+	{
+		return m_source.substr(offset, length);
+	}
+
+	std::string_view m_source;
+	std::vector<JsonNode> m_nodes;
+	std::vector<uint32_t> m_children;
+};
+
+/// <summary>
+/// Parses the given JSON text. Throws std::runtime_error on malformed input.
+/// </summary>
+/// <param name="text">The JSON text. Must outlive the returned document.</param>
+/// <returns>The parsed document.</returns>
+JsonDocument loadString(std::string_view text);
+
+/// <summary>
+/// Resolves the escape sequences of a raw JSON string.
+/// </summary>
+std::string unescape(std::string_view string);
+
+}
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include "loadjob.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+LoadJob::LoadJob(const std::string& filename, const LoadOptions& options)
+    : m_filename(filename), m_options(options)
+{
+    m_progress.preview = &m_preview;
+
+    // Started last so every member is constructed before the thread can touch it
+    m_thread = std::thread(&LoadJob::execute, this);
+}
+
+LoadJob::~LoadJob()
+{
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+
+    delete m_mesh;
+}
+
+void LoadJob::execute()
+{
+    try
+    {
+        m_mesh = loadMeshFile(m_filename, m_options, &m_progress);
+    }
+    catch (const std::exception& e)
+    {
+        m_error = e.what();
+    }
+
+    // Publishes m_mesh and m_error to the thread that observes the flag
+    m_finished.store(true, std::memory_order_release);
+}
+
+Mesh* LoadJob::takeMesh()
+{
+    if (!isFinished())
+    {
+        return nullptr;
+    }
+
+    Mesh* mesh = m_mesh;
+    m_mesh = nullptr;
+    return mesh;
+}
+
+}
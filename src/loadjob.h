@@ -0,0 +1,62 @@
+#ifndef LOADJOB_H
+#define LOADJOB_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "fileloader.h"
+#include "mesh.h"
+#include "trianglestream.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+/// <summary>
+/// Loads a model file on a background thread so the render loop can keep drawing the current
+/// mesh. The render thread polls isFinished() once per frame and takes the mesh when it's ready.
+/// </summary>
+class LoadJob
+{
+	std::string m_filename;
+	LoadOptions m_options;
+	LoadProgress m_progress;
+	TriangleStream m_preview;
+
+	std::atomic<bool> m_finished = false;
+	Mesh* m_mesh = nullptr;
+	std::string m_error;
+
+	std::thread m_thread;
+
+	void execute();
+
+public:
+	LoadJob(const std::string& filename, const LoadOptions& options = LoadOptions());
+	~LoadJob();
+
+	LoadJob(const LoadJob&) = delete;
+	LoadJob& operator=(const LoadJob&) = delete;
+
+	const std::string& getFilename() { return m_filename; }
+	double getProgress() { return m_progress.getFraction(); }
+
+	/// <summary>
+	/// Returns the triangles loaded so far. Only valid while the job is alive.
+	/// </summary>
+	TriangleStream* getPreview() { return &m_preview; }
+
+	bool isFinished() { return m_finished.load(std::memory_order_acquire); }
+	bool hasError() { return isFinished() && !m_error.empty(); }
+	const std::string& getError() { return m_error; }
+
+	/// <summary>
+	/// Returns the loaded mesh and releases ownership of it to the caller. Returns nullptr if the
+	/// job hasn't finished yet, failed, or the mesh was already taken.
+	/// </summary>
+	Mesh* takeMesh();
+};
+
+}
+
+#endif // !LOADJOB_H
@@ -0,0 +1,78 @@
+#include "mappedfile.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+
+    m_file = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_file, &fileSize))
+    {
+        close();
+        return false;
+    }
+    m_size = (size_t) fileSize.QuadPart;
+
+    // Windows refuses to map empty files; an open file with no data is still valid
+    if (m_size == 0)
+    {
+        return true;
+    }
+
+    m_mapping = CreateFileMapping(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    m_data = (const char*) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_data == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t MappedFile::getModifiedTime() const
+{
+    FILETIME writeTime;
+    if (!isOpen() || !GetFileTime(m_file, nullptr, nullptr, &writeTime))
+    {
+        return 0;
+    }
+    return ((uint64_t) writeTime.dwHighDateTime << 32) | writeTime.dwLowDateTime;
+}
+
+void MappedFile::close()
+{
+    if (m_data != nullptr)
+    {
+        UnmapViewOfFile(m_data);
+        m_data = nullptr;
+    }
+    if (m_mapping != nullptr)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+    m_size = 0;
+}
+
+}
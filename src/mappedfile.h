@@ -0,0 +1,58 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstdint>
+#include <string>
+#include <windows.h>
+
+namespace Graphics {
+using namespace Graphics;
+
+/// <summary>
+/// Read-only memory mapping of a file on disk. The whole file is exposed as a single contiguous
+/// block of bytes which stays valid until the MappedFile is closed or destroyed.
+/// </summary>
+class MappedFile
+{
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+
+public:
+	MappedFile() = default;
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+
+	/// <summary>
+	/// Opens and maps the given file. Any previously mapped file is closed first.
+	/// </summary>
+	/// <param name="filename">The file to map.</param>
+	/// <returns>Whether the file was opened and mapped.</returns>
+	bool open(const std::string& filename);
+
+	/// <summary>
+	/// Unmaps the view and releases the file handles.
+	/// </summary>
+	void close();
+
+	bool isOpen() const { return m_file != INVALID_HANDLE_VALUE; }
+
+	/// <summary>
+	/// Returns the last write time of the file, in 100-nanosecond intervals since 1601.
+	/// </summary>
+	uint64_t getModifiedTime() const;
+
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+	const char* begin() const { return m_data; }
+	const char* end() const { return m_data + m_size; }
+};
+
+}
+
+#endif
@@ -4,7 +4,7 @@
 #include <cstdlib>
 
 #include "core.h"
-#include "triangle.h"
+#include "vector.h"
 
 // Comparison
 #define     MAX(x, y)                   x > y ? x : y
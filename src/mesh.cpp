@@ -1,67 +1,161 @@
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
 #include "mesh.h"
+#include "maths.h"
+#include "parallel.h"
 
 namespace Graphics {
 using namespace Graphics;
 
-Mesh::Mesh(std::vector<Vertex> vertices, std::vector<int> indices)
-    : m_vertices(vertices), m_indices(indices)
+uint64 Mesh::nextGeneration()
 {
-    bindTris();
+    static std::atomic<uint64> generation = 0;
+    return ++generation;
 }
 
-void Mesh::addTri(Vertex* v1, Vertex* v2, Vertex* v3)
+void Mesh::computeFaceData()
 {
-    auto t = new Triangle(v1, v2, v3);
-    addTri(t);
-}
+    m_facePlanes.resize(numTriangles() * 4);
+    parallelFor(numTriangles(), MESH_PARALLEL_BATCH_SIZE, [this](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            Vector3 v1 = getPosition(m_indices[i * 3]);
+            Vector3 v2 = getPosition(m_indices[i * 3 + 1]);
+            Vector3 v3 = getPosition(m_indices[i * 3 + 2]);
 
-void Mesh::addTri(Triangle* t)
-{
-    m_triangles.push_back(t);
-}
+            // Zero-area triangles keep a zero plane rather than the NaNs normalizing would give them
+            Vector3 normal = Graphics::getNormal(v1, v2, v3);
+            double length = normal.length();
+            if (length > 0.0)
+            {
+                normal = normal / length;
+            }
 
-size_t Mesh::numVertices()
-{
-    return m_vertices.size();
-}
+            float* plane = &m_facePlanes[i * 4];
+            plane[0] = (float) normal._x;
+            plane[1] = (float) normal._y;
+            plane[2] = (float) normal._z;
+            plane[3] = (float) -dot(normal, v1);
+        }
+    });
 
-std::vector<Vertex> Mesh::getVertices(CoordSpace space)
-{
-    return m_vertices;
+    m_meshlets = buildMeshlets(m_positions, m_indices, m_facePlanes);
 }
 
-void Mesh::setVertices(const std::vector<Vertex> data)
+/// <summary>
+/// Exact bit pattern of a position, used to find vertices that share one.
+/// </summary>
+struct PositionKey
 {
-    m_vertices = data;
-}
+    uint32 bits[3];
+
+    bool operator == (const PositionKey& other) const
+    {
+        return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+    }
+};
 
-void Mesh::setIndices(const std::vector<int> data)
+struct PositionKeyHash
 {
-    m_indices = data;
-}
+    size_t operator () (const PositionKey& key) const
+    {
+        return ((size_t) key.bits[0] * 73856093u) ^ ((size_t) key.bits[1] * 19349663u) ^ ((size_t) key.bits[2] * 83492791u);
+    }
+};
 
-void Mesh::setNormals(const std::vector<Vector3> data)
+void Mesh::computeVertexNormals()
 {
-    for (int i = 0; i < m_vertices.size(); i++)
+    size_t vertexCount = numVertices();
+
+    // Give every distinct position an id
+    std::vector<uint32> shared(vertexCount);
+    size_t sharedCount = 0;
     {
-        m_vertices[i].setNormal(data[i]);
+        std::unordered_map<PositionKey, uint32, PositionKeyHash> ids;
+        ids.reserve(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            PositionKey key;
+            memcpy(key.bits, &m_positions[v * 3], sizeof(key.bits));
+            auto [it, inserted] = ids.try_emplace(key, (uint32) sharedCount);
+            sharedCount += inserted ? 1 : 0;
+            shared[v] = it->second;
+        }
     }
+
+    // Triangles around each position, packed
+    std::vector<uint32> offsets(sharedCount + 1, 0);
+    for (uint32 index : m_indices)
+    {
+        offsets[shared[index] + 1]++;
+    }
+    for (size_t i = 0; i < sharedCount; i++)
+    {
+        offsets[i + 1] += offsets[i];
+    }
+    std::vector<uint32> adjacency(m_indices.size());
+    std::vector<uint32> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < m_indices.size(); i++)
+    {
+        adjacency[fill[shared[m_indices[i]]]++] = (uint32) (i / 3);
+    }
+
+    // Sum the unnormalized face normals, which weights each by its triangle's area
+    std::vector<float> sharedNormals(sharedCount * 3);
+    parallelFor(sharedCount, MESH_PARALLEL_BATCH_SIZE, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            Vector3 sum;
+            for (uint32 j = offsets[i]; j < offsets[i + 1]; j++)
+            {
+                size_t triangle = adjacency[j];
+                Vector3 v1 = getPosition(m_indices[triangle * 3]);
+                Vector3 v2 = getPosition(m_indices[triangle * 3 + 1]);
+                Vector3 v3 = getPosition(m_indices[triangle * 3 + 2]);
+                sum = sum + Graphics::getNormal(v1, v2, v3);
+            }
+
+            double length = sum.length();
+            if (length > 0.0)
+            {
+                sum = sum / length;
+            }
+            sharedNormals[i * 3] = (float) sum._x;
+            sharedNormals[i * 3 + 1] = (float) sum._y;
+            sharedNormals[i * 3 + 2] = (float) sum._z;
+        }
+    });
+
+    m_normals.resize(vertexCount * 3);
+    parallelFor(vertexCount, MESH_PARALLEL_BATCH_SIZE, [&](size_t first, size_t last)
+    {
+        for (size_t v = first; v < last; v++)
+        {
+            std::copy_n(&sharedNormals[shared[v] * 3], 3, &m_normals[v * 3]);
+        }
+    });
 }
 
-void Mesh::bindTris()
+void Mesh::computeBounds()
 {
-    for (int i = 0; i < m_indices.size(); i++)
+    std::mutex mutex;
+    m_bounds = BoundingBox();
+    parallelFor(numVertices(), MESH_PARALLEL_BATCH_SIZE, [&](size_t first, size_t last)
     {
-        int i1 = m_indices[i]; i++;
-        int i2 = m_indices[i]; i++;
-        int i3 = m_indices[i];
+        BoundingBox bounds;
+        for (size_t i = first; i < last; i++)
+        {
+            bounds.expand(getPosition(i));
+        }
 
-        Vertex* v1 = &m_vertices[i1];
-        Vertex* v2 = &m_vertices[i2];
-        Vertex* v3 = &m_vertices[i3];
-
-        addTri(v1, v2, v3);
-    }
+        std::lock_guard<std::mutex> lock(mutex);
+        m_bounds.expand(bounds);
+    });
 }
 
-}
\ No newline at end of file
+}
@@ -1,41 +1,210 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <span>
 #include <vector>
 
-#include "coordinates.h"
-#include "triangle.h"
+#include "boundingbox.h"
+#include "bvh.h"
+#include "core.h"
+#include "meshlet.h"
+#include "vector.h"
 
 namespace Graphics {
 using namespace Graphics;
 
+constexpr size_t MESH_PARALLEL_BATCH_SIZE = 1 << 14;	// Smallest batch of triangles or vertices worth a thread
+
+/// <summary>
+/// Non-owning view of the streams the renderer reads from a mesh. Binding one is O(1); it stays
+/// valid until the mesh is modified or deleted.
+/// </summary>
+struct MeshView
+{
+	std::span<const float> positions;
+	std::span<const float> normals;			// Empty when the mesh has no vertex normals
+	std::span<const float> facePlanes;
+	std::span<const uint32> indices;
+	std::span<const Meshlet> meshlets;
+	BoundingBox bounds;
+	const Bvh* bvh = nullptr;				// Empty until the mesh's BVH is built
+	std::span<const uint32> sourceTriangles;	// Empty unless the mesh is a simplified level
+	uint64 generation = 0;					// Changes whenever the geometry does, see Mesh::getGeneration()
+
+	bool hasBvh() const { return bvh != nullptr && !bvh->empty(); }
+
+	/// <summary>
+	/// Returns the triangle of the full detail mesh the given triangle stands in for, so IDs
+	/// agree whichever level was drawn.
+	/// </summary>
+	uint32 getSourceTriangle(size_t triangle) const
+	{
+		return sourceTriangles.empty() ? (uint32) triangle : sourceTriangles[triangle];
+	}
+
+	size_t numVertices() const { return positions.size() / 3; }
+	size_t numTriangles() const { return indices.size() / 3; }
+	bool hasNormals() const { return !normals.empty(); }
+
+	Vector3 getPosition(uint32 vertex) const
+	{
+		const float* p = &positions[(size_t) vertex * 3];
+		return Vector3(p[0], p[1], p[2]);
+	}
+	Vector3 getNormal(uint32 vertex) const
+	{
+		const float* n = &normals[(size_t) vertex * 3];
+		return Vector3(n[0], n[1], n[2]);
+	}
+	Vector3 getFaceNormal(size_t triangle) const
+	{
+		const float* n = &facePlanes[triangle * 4];
+		return Vector3(n[0], n[1], n[2]);
+	}
+
+	/// <summary>
+	/// Signed distance from the plane of the given triangle to a point; positive in front.
+	/// </summary>
+	double getFaceDistance(size_t triangle, const Vector3& point) const
+	{
+		const float* plane = &facePlanes[triangle * 4];
+		return plane[0] * point._x + plane[1] * point._y + plane[2] * point._z + plane[3];
+	}
+};
+
+/// <summary>
+/// Triangle mesh stored as flat structure-of-arrays streams. Vertex attributes are tightly packed
+/// floats indexed by vertex, every three indices form one triangle, and per-face data is indexed by
+/// triangle. Normals and UVs are optional; their streams are empty when the source had none.
+/// </summary>
 class Mesh
 {
 public:
 	Mesh() {};
-	Mesh(std::vector<Vertex> vertices, std::vector<int> indices);
 
-	void addTri(Vertex* v1, Vertex* v2, Vertex* v3);
-	void addTri(Triangle* t);
-	size_t numVertices();
+	// Meshes can be very large, they are only ever passed around by pointer
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+
+	size_t numVertices() const { return m_positions.size() / 3; }
+	size_t numTriangles() const { return m_indices.size() / 3; }
+
+	bool hasNormals() const { return !m_normals.empty(); }
+	bool hasUVs() const { return !m_uvs.empty(); }
+
+	Vector3 getPosition(size_t vertex) const
+	{
+		const float* p = &m_positions[vertex * 3];
+		return Vector3(p[0], p[1], p[2]);
+	}
+	Vector3 getNormal(size_t vertex) const
+	{
+		const float* n = &m_normals[vertex * 3];
+		return Vector3(n[0], n[1], n[2]);
+	}
+	Vector2 getUV(size_t vertex) const
+	{
+		const float* uv = &m_uvs[vertex * 2];
+		return Vector2(uv[0], uv[1]);
+	}
+	uint32 getIndex(size_t i) const { return m_indices[i]; }
+	Vector3 getFaceNormal(size_t triangle) const
+	{
+		const float* n = &m_facePlanes[triangle * 4];
+		return Vector3(n[0], n[1], n[2]);
+	}
+
+	std::span<const float> getPositions() const { return m_positions; }
+	std::span<const float> getNormals() const { return m_normals; }
+	std::span<const float> getUVs() const { return m_uvs; }
+	std::span<const uint32> getIndices() const { return m_indices; }
+	std::span<const float> getFacePlanes() const { return m_facePlanes; }
+	std::span<const Meshlet> getMeshlets() const { return m_meshlets; }
+	MeshView getView() const { return { m_positions, m_normals, m_facePlanes, m_indices, m_meshlets, m_bounds, &m_bvh, m_sourceTriangles, m_generation }; }
 
-	std::vector<Vertex> getVertices() { return m_vertices;}
-	std::vector<Vertex> getVertices(CoordSpace space);
-	std::vector<int> getIndices() { return m_indices; }
-	std::vector<Triangle*> getTris() { return m_triangles; }
+	/// <summary>
+	/// Returns a number unique to the current positions and indices of this mesh, across every
+	/// mesh. Caches of derived data can key on it rather than on stream addresses, which a new
+	/// mesh may reuse.
+	/// </summary>
+	uint64 getGeneration() const { return m_generation; }
 
-	void setVertices(const std::vector<Vertex> data);
-	void setIndices(const std::vector<int> data);
-	void setNormals(const std::vector<Vector3> data);
-	void bindTris();
+	// Streams are moved in, never copied
+	void setPositions(std::vector<float>&& data) { m_positions = std::move(data); m_generation = nextGeneration(); }
+	void setNormals(std::vector<float>&& data) { m_normals = std::move(data); }
+	void setUVs(std::vector<float>&& data) { m_uvs = std::move(data); }
+	void setIndices(std::vector<uint32>&& data) { m_indices = std::move(data); m_generation = nextGeneration(); }
+
+	/// <summary>
+	/// Sets, for a simplified mesh, the triangle of the full detail mesh each triangle was
+	/// collapsed from. Empty for a mesh that is its own source.
+	/// </summary>
+	void setSourceTriangles(std::vector<uint32>&& data) { m_sourceTriangles = std::move(data); }
+	std::span<const uint32> getSourceTriangles() const { return m_sourceTriangles; }
+
+	/// <summary>
+	/// Fills the per-face streams and splits the triangles into meshlets, from the current
+	/// positions and indices. Call once the geometry is set, and again after reordering it. Large
+	/// meshes are processed in parallel.
+	/// </summary>
+	void computeFaceData();
+
+	/// <summary>
+	/// Sets per-face streams computed earlier for the same geometry, such as from a cache, in
+	/// place of computeFaceData().
+	/// </summary>
+	void setFaceData(std::vector<float>&& facePlanes, std::vector<Meshlet>&& meshlets)
+	{
+		m_facePlanes = std::move(facePlanes);
+		m_meshlets = std::move(meshlets);
+	}
+
+	const BoundingBox& getBounds() { return m_bounds; }
+	void setBounds(const BoundingBox& bounds) { m_bounds = bounds; }
+
+	/// <summary>
+	/// Generates smooth vertex normals by summing the area-weighted normals of the triangles
+	/// around each position. Vertices that share a position get the same normal, so UV seams don't
+	/// show. The summing runs in parallel for large meshes.
+	/// </summary>
+	void computeVertexNormals();
+
+	/// <summary>
+	/// Recomputes the bounds from the positions. Large meshes are processed in parallel.
+	/// </summary>
+	void computeBounds();
+
+	/// <summary>
+	/// Builds the triangle BVH used for ray queries from the current positions and indices. It is
+	/// not kept up to date; rebuild it after changing the geometry.
+	/// </summary>
+	void computeBvh() { m_bvh.build(m_positions, m_indices); }
+
+	const Bvh& getBvh() const { return m_bvh; }
+	Bvh& getBvh() { return m_bvh; }
 
 private:
-	std::vector<Vertex> m_vertices;
-	std::vector<int> m_indices;
+	static uint64 nextGeneration();
+
+	uint64 m_generation = nextGeneration();
+
+	// Per vertex
+	std::vector<float> m_positions;		// x, y, z
+	std::vector<float> m_normals;		// x, y, z
+	std::vector<float> m_uvs;			// u, v
+
+	// Per triangle
+	std::vector<uint32> m_indices;		// Three vertex indices
+	std::vector<float> m_facePlanes;	// Unit normal x, y, z, then the plane offset d = -dot(normal, v1)
+	std::vector<uint32> m_sourceTriangles;	// Full detail triangle, only for simplified meshes
+
+	// Clusters of consecutive triangles
+	std::vector<Meshlet> m_meshlets;
 
-	std::vector<Triangle*> m_triangles;
+	BoundingBox m_bounds;
+	Bvh m_bvh;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
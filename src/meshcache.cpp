@@ -0,0 +1,263 @@
+#include <fstream>
+
+#include "mappedfile.h"
+#include "meshcache.h"
+
+namespace Graphics
+{
+    constexpr size_t MESH_CACHE_HASH_SAMPLE = 1 << 16;    // Bytes hashed from each end of the source
+    constexpr uint64 FNV_OFFSET_BASIS = 14695981039346656037ull;
+    constexpr uint64 FNV_PRIME = 1099511628211ull;
+
+    static uint64 hashBytes(const char* data, size_t size, uint64 hash)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ (uint8) data[i]) * FNV_PRIME;
+        }
+        return hash;
+    }
+
+    static uint64 alignOffset(uint64 offset)
+    {
+        return (offset + 15) & ~(uint64) 15;
+    }
+
+    /// <summary>
+    /// Returns whether a stream of the given number of elements fits in the file at the given
+    /// offset, which must be aligned and past the header. Divides rather than multiplies, so huge
+    /// counts in a corrupt header can't wrap around.
+    /// </summary>
+    static bool isStreamInFile(uint64 offset, uint64 count, size_t elementSize, size_t fileSize)
+    {
+        return offset >= sizeof(MeshCacheHeader) && offset % 16 == 0 && offset <= fileSize &&
+               count <= (fileSize - offset) / elementSize;
+    }
+
+    std::string getMeshCachePath(const std::string& filename)
+    {
+        return filename + MESH_CACHE_EXTENSION;
+    }
+
+    bool getMeshCacheSource(const std::string& filename, MeshCacheSource& source)
+    {
+        MappedFile file;
+        if (!file.open(filename))
+        {
+            return false;
+        }
+
+        source.size = file.size();
+        source.modifiedTime = file.getModifiedTime();
+
+        // Hash the head and the tail of the file, plus its size
+        size_t sample = std::min(file.size(), MESH_CACHE_HASH_SAMPLE);
+        uint64 hash = hashBytes(file.data(), sample, FNV_OFFSET_BASIS);
+        hash = hashBytes(file.end() - sample, sample, hash);
+        source.hash = hashBytes(reinterpret_cast<const char*>(&source.size), sizeof(source.size), hash);
+
+        return true;
+    }
+
+    Mesh* readMeshCache(const std::string& filename, uint32* flags)
+    {
+        MeshCacheSource source;
+        if (!getMeshCacheSource(filename, source))
+        {
+            return nullptr;
+        }
+
+        MappedFile file;
+        if (!file.open(getMeshCachePath(filename)) || file.size() < sizeof(MeshCacheHeader))
+        {
+            return nullptr;
+        }
+
+        // Validate the header against the current state of the source file. Absent normal and UV
+        // streams are stored with an offset of zero.
+        MeshCacheHeader header;
+        memcpy(&header, file.data(), sizeof(MeshCacheHeader));
+        if (header.magic != MESH_CACHE_MAGIC ||
+            header.version != MESH_CACHE_VERSION ||
+            header.fileSize != file.size() ||
+            !(header.source == source) ||
+            !isStreamInFile(header.positionsOffset, header.vertexCount, 3 * sizeof(float), file.size()) ||
+            (header.normalsOffset != 0 && !isStreamInFile(header.normalsOffset, header.vertexCount, 3 * sizeof(float), file.size())) ||
+            (header.uvsOffset != 0 && !isStreamInFile(header.uvsOffset, header.vertexCount, 2 * sizeof(float), file.size())) ||
+            !isStreamInFile(header.indicesOffset, header.indexCount, sizeof(uint32), file.size()) ||
+            header.indexCount % 3 != 0)
+        {
+            return nullptr;
+        }
+
+        auto positions = reinterpret_cast<const float*>(file.data() + header.positionsOffset);
+        auto normals = reinterpret_cast<const float*>(file.data() + header.normalsOffset);
+        auto uvs = reinterpret_cast<const float*>(file.data() + header.uvsOffset);
+        auto indices = reinterpret_cast<const uint32*>(file.data() + header.indicesOffset);
+
+        // The streams are stored exactly as the mesh holds them
+        Mesh* mesh = new Mesh();
+        mesh->setPositions(std::vector<float>(positions, positions + header.vertexCount * 3));
+        if (header.normalsOffset != 0)
+        {
+            mesh->setNormals(std::vector<float>(normals, normals + header.vertexCount * 3));
+        }
+        if (header.uvsOffset != 0)
+        {
+            mesh->setUVs(std::vector<float>(uvs, uvs + header.vertexCount * 2));
+        }
+        mesh->setIndices(std::vector<uint32>(indices, indices + header.indexCount));
+        mesh->setBounds(BoundingBox(Vector3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]),
+                                    Vector3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2])));
+
+        // Out of range indices would make every later pass read out of bounds
+        for (size_t i = 0; i < header.indexCount; i++)
+        {
+            if (indices[i] >= header.vertexCount)
+            {
+                delete mesh;
+                return nullptr;
+            }
+        }
+
+        // Derived streams are used as stored when they are present and consistent, and rebuilt
+        // otherwise
+        uint64 triangleCount = header.indexCount / 3;
+        bool faceData = header.facePlanesOffset != 0 && header.meshletsOffset != 0 &&
+                        isStreamInFile(header.facePlanesOffset, triangleCount, 4 * sizeof(float), file.size()) &&
+                        isStreamInFile(header.meshletsOffset, header.meshletCount, sizeof(Meshlet), file.size());
+        if (faceData)
+        {
+            auto facePlanes = reinterpret_cast<const float*>(file.data() + header.facePlanesOffset);
+            std::vector<Meshlet> meshlets(header.meshletCount);
+            memcpy(meshlets.data(), file.data() + header.meshletsOffset, meshlets.size() * sizeof(Meshlet));
+            for (const Meshlet& meshlet : meshlets)
+            {
+                faceData = faceData && (uint64) meshlet.firstTriangle + meshlet.triangleCount <= triangleCount;
+            }
+            if (faceData)
+            {
+                mesh->setFaceData(std::vector<float>(facePlanes, facePlanes + triangleCount * 4), std::move(meshlets));
+            }
+        }
+        if (!faceData)
+        {
+            mesh->computeFaceData();
+        }
+
+        if (header.bvhNodesOffset != 0 &&
+            isStreamInFile(header.bvhNodesOffset, header.bvhNodeCount, sizeof(Bvh::Node), file.size()) &&
+            isStreamInFile(header.bvhTrianglesOffset, header.bvhTriangleCount, sizeof(uint32), file.size()) &&
+            isStreamInFile(header.bvhCornersOffset, header.bvhTriangleCount, 9 * sizeof(float), file.size()))
+        {
+            std::vector<Bvh::Node> nodes(header.bvhNodeCount);
+            memcpy(nodes.data(), file.data() + header.bvhNodesOffset, nodes.size() * sizeof(Bvh::Node));
+            auto triangles = reinterpret_cast<const uint32*>(file.data() + header.bvhTrianglesOffset);
+            auto corners = reinterpret_cast<const float*>(file.data() + header.bvhCornersOffset);
+            mesh->getBvh().assign(std::move(nodes),
+                                  std::vector<uint32>(triangles, triangles + header.bvhTriangleCount),
+                                  std::vector<float>(corners, corners + header.bvhTriangleCount * 9),
+                                  triangleCount);
+        }
+
+        if (flags != nullptr)
+        {
+            *flags = header.flags;
+        }
+
+        return mesh;
+    }
+
+    bool writeMeshCache(const std::string& filename, Mesh* mesh, uint32 flags)
+    {
+        MeshCacheHeader header;
+        header.flags = flags;
+        if (!getMeshCacheSource(filename, header.source))
+        {
+            return false;
+        }
+
+        std::span<const float> positions = mesh->getPositions();
+        std::span<const float> normals = mesh->getNormals();
+        std::span<const float> uvs = mesh->getUVs();
+        std::span<const uint32> indices = mesh->getIndices();
+        std::span<const float> facePlanes = mesh->getFacePlanes();
+        std::span<const Meshlet> meshlets = mesh->getMeshlets();
+        const Bvh& bvh = mesh->getBvh();
+        const BoundingBox& bounds = mesh->getBounds();
+
+        header.vertexCount = mesh->numVertices();
+        header.indexCount = indices.size();
+        for (int i = 0; i < 3; i++)
+        {
+            header.boundsMin[i] = (float) bounds.getMin()[i];
+            header.boundsMax[i] = (float) bounds.getMax()[i];
+        }
+
+        uint64 offset = alignOffset(sizeof(MeshCacheHeader));
+        header.positionsOffset = offset;
+        offset = alignOffset(offset + positions.size() * sizeof(float));
+        header.normalsOffset = normals.empty() ? 0 : offset;
+        offset = alignOffset(offset + normals.size() * sizeof(float));
+        header.uvsOffset = uvs.empty() ? 0 : offset;
+        offset = alignOffset(offset + uvs.size() * sizeof(float));
+        header.indicesOffset = offset;
+        offset = alignOffset(offset + indices.size() * sizeof(uint32));
+
+        // Face data is only stored when it matches the triangles
+        bool faceData = facePlanes.size() == mesh->numTriangles() * 4 && !meshlets.empty();
+        header.facePlanesOffset = faceData ? offset : 0;
+        offset = alignOffset(offset + (faceData ? facePlanes.size_bytes() : 0));
+        header.meshletCount = faceData ? meshlets.size() : 0;
+        header.meshletsOffset = faceData ? offset : 0;
+        offset = alignOffset(offset + (faceData ? meshlets.size_bytes() : 0));
+
+        header.bvhNodeCount = bvh.getNodes().size();
+        header.bvhTriangleCount = bvh.getTriangles().size();
+        header.bvhNodesOffset = bvh.empty() ? 0 : offset;
+        offset = alignOffset(offset + bvh.getNodes().size_bytes());
+        header.bvhTrianglesOffset = bvh.empty() ? 0 : offset;
+        offset = alignOffset(offset + bvh.getTriangles().size_bytes());
+        header.bvhCornersOffset = bvh.empty() ? 0 : offset;
+        offset += bvh.getCorners().size_bytes();
+        header.fileSize = offset;
+
+        std::ofstream file(getMeshCachePath(filename), std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+
+        auto writeAt = [&file](uint64 offset, const void* data, size_t size)
+        {
+            static const char padding[16] = {};
+            file.write(padding, (std::streamsize) (offset - (uint64) file.tellp()));
+            file.write(static_cast<const char*>(data), (std::streamsize) size);
+        };
+
+        writeAt(0, &header, sizeof(MeshCacheHeader));
+        writeAt(header.positionsOffset, positions.data(), positions.size() * sizeof(float));
+        if (!normals.empty())
+        {
+            writeAt(header.normalsOffset, normals.data(), normals.size() * sizeof(float));
+        }
+        if (!uvs.empty())
+        {
+            writeAt(header.uvsOffset, uvs.data(), uvs.size() * sizeof(float));
+        }
+        writeAt(header.indicesOffset, indices.data(), indices.size() * sizeof(uint32));
+        if (faceData)
+        {
+            writeAt(header.facePlanesOffset, facePlanes.data(), facePlanes.size_bytes());
+            writeAt(header.meshletsOffset, meshlets.data(), meshlets.size_bytes());
+        }
+        if (!bvh.empty())
+        {
+            writeAt(header.bvhNodesOffset, bvh.getNodes().data(), bvh.getNodes().size_bytes());
+            writeAt(header.bvhTrianglesOffset, bvh.getTriangles().data(), bvh.getTriangles().size_bytes());
+            writeAt(header.bvhCornersOffset, bvh.getCorners().data(), bvh.getCorners().size_bytes());
+        }
+
+        return file.good();
+    }
+}
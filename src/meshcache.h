@@ -0,0 +1,96 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <string>
+
+#include "core.h"
+#include "mesh.h"
+
+#define MESH_CACHE_EXTENSION ".meshcache"
+
+namespace Graphics
+{
+    constexpr uint32 MESH_CACHE_MAGIC = 0x4853454D;     // 'MESH'
+    constexpr uint32 MESH_CACHE_VERSION = 5;
+
+    // Header flags
+    constexpr uint32 MESH_CACHE_OPTIMIZED = 1 << 0;     // Triangles and vertices were reordered for locality
+
+    /// <summary>
+    /// Identifies the exact source file a cache was built from. The hash only covers the head and tail
+    /// of the file so validating the cache of a multi-gigabyte scan does not read the whole scan.
+    /// </summary>
+    struct MeshCacheSource
+    {
+        uint64 size = 0;
+        uint64 modifiedTime = 0;
+        uint64 hash = 0;
+
+        bool operator == (const MeshCacheSource& other) const
+        {
+            return size == other.size && modifiedTime == other.modifiedTime && hash == other.hash;
+        }
+    };
+
+    /// <summary>
+    /// Fixed-size header at the start of every cache file. All streams are stored little-endian at
+    /// 16-byte aligned offsets from the start of the file:
+    /// positions (float x3), normals (float x3), uvs (float x2), indices (uint32), face planes
+    /// (float x4), meshlets, then the BVH's nodes, leaf triangles (uint32) and corners (float x9).
+    /// Everything after the indices is derived data, stored so opening a cached mesh doesn't
+    /// recompute it. Only positions and indices are required; a missing stream has an offset of
+    /// zero and is rebuilt on load.
+    /// </summary>
+    struct MeshCacheHeader
+    {
+        uint32 magic = MESH_CACHE_MAGIC;
+        uint32 version = MESH_CACHE_VERSION;
+        uint32 flags = 0;
+        MeshCacheSource source;
+
+        uint64 vertexCount = 0;
+        uint64 indexCount = 0;
+        float boundsMin[3] = { 0.0f, 0.0f, 0.0f };
+        float boundsMax[3] = { 0.0f, 0.0f, 0.0f };
+
+        uint64 positionsOffset = 0;
+        uint64 normalsOffset = 0;
+        uint64 uvsOffset = 0;
+        uint64 indicesOffset = 0;
+        uint64 facePlanesOffset = 0;
+        uint64 meshletCount = 0;
+        uint64 meshletsOffset = 0;
+        uint64 bvhNodeCount = 0;
+        uint64 bvhNodesOffset = 0;
+        uint64 bvhTriangleCount = 0;
+        uint64 bvhTrianglesOffset = 0;
+        uint64 bvhCornersOffset = 0;
+        uint64 fileSize = 0;
+    };
+
+    /// <summary>
+    /// Returns the path of the cache file which sits next to the given source file.
+    /// </summary>
+    std::string getMeshCachePath(const std::string& filename);
+
+    /// <summary>
+    /// Reads the size, modification time and sampled hash of the given source file.
+    /// </summary>
+    /// <returns>Whether the file could be read.</returns>
+    bool getMeshCacheSource(const std::string& filename, MeshCacheSource& source);
+
+    /// <summary>
+    /// Maps the cache of the given source file and builds a mesh from it.
+    /// </summary>
+    /// <param name="flags">If given, receives the flags the cache was written with.</param>
+    /// <returns>The cached mesh, or nullptr if there is no cache or it is out of date.</returns>
+    Mesh* readMeshCache(const std::string& filename, uint32* flags = nullptr);
+
+    /// <summary>
+    /// Writes the given mesh to the cache file of the given source file.
+    /// </summary>
+    /// <returns>Whether the cache was written.</returns>
+    bool writeMeshCache(const std::string& filename, Mesh* mesh, uint32 flags = 0);
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cfloat>
+
+#include "boundingbox.h"
+#include "meshlet.h"
+#include "parallel.h"
+
+namespace Graphics
+{
+    constexpr size_t MESHLET_MIN_TRIANGLES = 64;            // Size before a meshlet may be split for its normals
+    constexpr double MESHLET_MIN_CONE_COS = 0.5;            // Triangles further than 60 degrees from the average start a new meshlet
+    constexpr size_t MESHLET_PARALLEL_BATCH_SIZE = 256;     // Meshlets per thread when computing bounds
+
+    static Vector3 getPosition(std::span<const float> positions, uint32 vertex)
+    {
+        const float* p = &positions[(size_t) vertex * 3];
+        return Vector3(p[0], p[1], p[2]);
+    }
+
+    /// <summary>
+    /// Fills in the bounding sphere and normal cone of a meshlet whose triangle range is set.
+    /// </summary>
+    static void computeMeshletBounds(Meshlet& meshlet, std::span<const float> positions, std::span<const uint32> indices,
+                                     std::span<const float> facePlanes)
+    {
+        size_t first = meshlet.firstTriangle;
+        size_t last = first + meshlet.triangleCount;
+
+        // Sphere around the center of the box
+        BoundingBox box;
+        for (size_t i = first * 3; i < last * 3; i++)
+        {
+            box.expand(getPosition(positions, indices[i]));
+        }
+        Vector3 center = box.getCenter();
+        double radiusSquared = 0.0;
+        for (size_t i = first * 3; i < last * 3; i++)
+        {
+            Vector3 offset = getPosition(positions, indices[i]) - center;
+            radiusSquared = std::max(radiusSquared, dot(offset, offset));
+        }
+
+        // Cone around the average normal. Degenerate triangles have no normal and never draw.
+        Vector3 axis;
+        for (size_t t = first; t < last; t++)
+        {
+            axis = axis + Vector3(facePlanes[t * 4], facePlanes[t * 4 + 1], facePlanes[t * 4 + 2]);
+        }
+        double axisLength = axis.length();
+
+        double coneCos = -1.0;
+        if (axisLength > 0.0)
+        {
+            axis = axis / axisLength;
+            coneCos = 1.0;
+            for (size_t t = first; t < last; t++)
+            {
+                Vector3 normal(facePlanes[t * 4], facePlanes[t * 4 + 1], facePlanes[t * 4 + 2]);
+                if (dot(normal, normal) > 0.0)
+                {
+                    coneCos = std::min(coneCos, dot(normal, axis));
+                }
+            }
+        }
+
+        meshlet.center[0] = (float) center._x;
+        meshlet.center[1] = (float) center._y;
+        meshlet.center[2] = (float) center._z;
+        meshlet.radius = (float) std::sqrt(radiusSquared) * (1.0f + FLT_EPSILON);
+        meshlet.coneAxis[0] = (float) axis._x;
+        meshlet.coneAxis[1] = (float) axis._y;
+        meshlet.coneAxis[2] = (float) axis._z;
+
+        // Float rounding only ever widens the cone
+        meshlet.coneCos = (float) std::max(coneCos - 1e-4, -1.0);
+        meshlet.coneSin = (float) std::sqrt(1.0 - (double) meshlet.coneCos * meshlet.coneCos);
+    }
+
+    std::vector<Meshlet> buildMeshlets(std::span<const float> positions, std::span<const uint32> indices,
+                                       std::span<const float> facePlanes)
+    {
+        std::vector<Meshlet> meshlets;
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+        {
+            return meshlets;
+        }
+
+        // Stamp each vertex with the last meshlet that used it, to count distinct vertices
+        std::vector<uint32> lastMeshlet(positions.size() / 3, UINT32_MAX);
+        Meshlet current;
+        size_t vertexCount = 0;
+        Vector3 normalSum;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            uint32 id = (uint32) meshlets.size();
+            size_t newVertices = 0;
+            for (size_t c = 0; c < 3; c++)
+            {
+                uint32 vertex = indices[t * 3 + c];
+                newVertices += lastMeshlet[vertex] != id ? 1 : 0;
+            }
+
+            // Past the minimum size, also stop before a triangle that would widen the normal cone
+            // too far for the meshlet to ever be culled as back-facing
+            Vector3 normal(facePlanes[t * 4], facePlanes[t * 4 + 1], facePlanes[t * 4 + 2]);
+            double sumLength = normalSum.length();
+            bool divergent = current.triangleCount >= MESHLET_MIN_TRIANGLES && sumLength > 0.0 &&
+                             dot(normal, normalSum) < MESHLET_MIN_CONE_COS * sumLength;
+
+            if (current.triangleCount == MESHLET_MAX_TRIANGLES || vertexCount + newVertices > MESHLET_MAX_VERTICES || divergent)
+            {
+                meshlets.push_back(current);
+                current = Meshlet();
+                current.firstTriangle = (uint32) t;
+                vertexCount = 0;
+                normalSum = Vector3();
+                id++;
+            }
+
+            for (size_t c = 0; c < 3; c++)
+            {
+                uint32 vertex = indices[t * 3 + c];
+                if (lastMeshlet[vertex] != id)
+                {
+                    lastMeshlet[vertex] = id;
+                    vertexCount++;
+                }
+            }
+            normalSum = normalSum + normal;
+            current.triangleCount++;
+        }
+        meshlets.push_back(current);
+
+        parallelFor(meshlets.size(), MESHLET_PARALLEL_BATCH_SIZE, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                computeMeshletBounds(meshlets[i], positions, indices, facePlanes);
+            }
+        });
+
+        return meshlets;
+    }
+}
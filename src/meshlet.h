@@ -0,0 +1,81 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <cmath>
+#include <span>
+#include <vector>
+
+#include "core.h"
+#include "maths.h"
+
+namespace Graphics
+{
+    constexpr size_t MESHLET_MAX_TRIANGLES = 128;
+    constexpr size_t MESHLET_MAX_VERTICES = 64;     // Distinct vertices, keeps clusters compact
+
+    /// <summary>
+    /// A run of consecutive triangles in a mesh's index buffer, with the bounds used to reject the
+    /// whole run at once.
+    /// </summary>
+    struct Meshlet
+    {
+        uint32 firstTriangle = 0;
+        uint32 triangleCount = 0;
+
+        // Bounding sphere
+        float center[3] = {};
+        float radius = 0.0f;
+
+        // Normal cone; every face normal is within the cone's half angle of the axis. A cosine of
+        // -1 means the normals are too spread out to bound.
+        float coneAxis[3] = {};
+        float coneSin = 1.0f;
+        float coneCos = -1.0f;
+
+        Vector3 getCenter() const { return Vector3(center[0], center[1], center[2]); }
+        Vector3 getConeAxis() const { return Vector3(coneAxis[0], coneAxis[1], coneAxis[2]); }
+
+        /// <summary>
+        /// Returns whether every triangle in the meshlet faces away from the given point. This is
+        /// conservative; false only means some triangle might face it.
+        /// </summary>
+        bool isBackfacing(const Vector3& eye) const
+        {
+            if (coneCos <= 0.0f)
+            {
+                return false;
+            }
+
+            Vector3 toCenter = getCenter() - eye;
+            double distance = toCenter.length();
+            if (distance <= radius)
+            {
+                return false;
+            }
+
+            // Widen the cone by the angle the sphere covers as seen from the eye. If the widened
+            // cone still points away from the eye by more than 90 degrees, so does every face.
+            double sphereSin = radius / distance;
+            double sphereCos = std::sqrt(1.0 - sphereSin * sphereSin);
+            if (coneCos * sphereCos - coneSin * sphereSin <= 0.0)
+            {
+                return false;
+            }
+
+            return dot(getConeAxis(), toCenter) >= distance * (coneSin * sphereCos + coneCos * sphereSin);
+        }
+    };
+
+    /// <summary>
+    /// Splits the triangles, in their current order, into meshlets of at most MESHLET_MAX_TRIANGLES
+    /// triangles and MESHLET_MAX_VERTICES vertices, and computes their bounds. Meshes that went
+    /// through optimizeMesh() are in cache order, which keeps each meshlet a compact patch.
+    /// </summary>
+    /// <param name="positions">Vertex positions, x, y, z.</param>
+    /// <param name="indices">Three vertex indices per triangle.</param>
+    /// <param name="facePlanes">Per-triangle unit normal and plane offset.</param>
+    std::vector<Meshlet> buildMeshlets(std::span<const float> positions, std::span<const uint32> indices,
+                                       std::span<const float> facePlanes);
+}
+
+#endif
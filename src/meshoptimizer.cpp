@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "meshoptimizer.h"
+
+namespace Graphics
+{
+    constexpr float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+    constexpr float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+    constexpr float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+    constexpr float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+    constexpr size_t FORSYTH_MAX_VALENCE = 64;      // Valences above this share the last score
+
+    /// <summary>
+    /// Precomputed vertex scores, by cache position and by remaining valence.
+    /// </summary>
+    struct ForsythScores
+    {
+        std::array<float, VERTEX_CACHE_SIZE> cache;
+        std::array<float, FORSYTH_MAX_VALENCE + 1> valence;
+
+        ForsythScores()
+        {
+            for (size_t i = 0; i < VERTEX_CACHE_SIZE; i++)
+            {
+                // The last triangle's vertices get a fixed score so the next triangle doesn't
+                // just reuse the same edge
+                if (i < 3)
+                {
+                    cache[i] = FORSYTH_LAST_TRIANGLE_SCORE;
+                }
+                else
+                {
+                    float scale = 1.0f - (float) (i - 3) / (float) (VERTEX_CACHE_SIZE - 3);
+                    cache[i] = std::pow(scale, FORSYTH_CACHE_DECAY_POWER);
+                }
+            }
+
+            // Vertices with few triangles left are boosted so they get finished off
+            valence[0] = 0.0f;
+            for (size_t i = 1; i <= FORSYTH_MAX_VALENCE; i++)
+            {
+                valence[i] = FORSYTH_VALENCE_BOOST_SCALE * std::pow((float) i, -FORSYTH_VALENCE_BOOST_POWER);
+            }
+        }
+
+        float get(int cachePosition, uint32 remaining) const
+        {
+            if (remaining == 0)
+            {
+                return -1.0f;
+            }
+
+            float score = cachePosition >= 0 ? cache[cachePosition] : 0.0f;
+            return score + valence[std::min<size_t>(remaining, FORSYTH_MAX_VALENCE)];
+        }
+    };
+
+    double computeACMR(std::span<const uint32> indices, size_t vertexCount, size_t cacheSize)
+    {
+        if (indices.size() < 3)
+        {
+            return 0.0;
+        }
+
+        // A vertex is in the FIFO if fewer than cacheSize misses happened since it was last loaded
+        std::vector<size_t> loadedAt(vertexCount, 0);
+        size_t misses = 0;
+        for (uint32 index : indices)
+        {
+            if (misses + cacheSize - loadedAt[index] >= cacheSize)
+            {
+                misses++;
+                loadedAt[index] = misses + cacheSize;
+            }
+        }
+
+        return (double) misses / (double) (indices.size() / 3);
+    }
+
+    void optimizeVertexCache(std::vector<uint32>& indices, size_t vertexCount)
+    {
+        static const ForsythScores scores;
+
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+        {
+            return;
+        }
+
+        // Vertex -> triangle adjacency, packed. The live triangles of vertex v are
+        // adjacency[offsets[v], offsets[v] + remaining[v]).
+        std::vector<uint32> remaining(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+        {
+            remaining[indices[i]]++;
+        }
+
+        std::vector<size_t> offsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            offsets[v + 1] = offsets[v] + remaining[v];
+        }
+
+        std::vector<uint32> adjacency(triangleCount * 3);
+        std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (size_t corner = 0; corner < 3; corner++)
+            {
+                adjacency[fill[indices[t * 3 + corner]]++] = (uint32) t;
+            }
+        }
+
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> vertexScore(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            vertexScore[v] = scores.get(-1, remaining[v]);
+        }
+
+        std::vector<float> triangleScore(triangleCount);
+        std::vector<bool> emitted(triangleCount, false);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            const uint32* tri = &indices[t * 3];
+            triangleScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+        }
+
+        std::vector<uint32> result;
+        result.reserve(triangleCount * 3);
+
+        std::vector<uint32> cache;
+        std::vector<uint32> nextCache;
+        cache.reserve(VERTEX_CACHE_SIZE + 3);
+        nextCache.reserve(VERTEX_CACHE_SIZE + 3);
+
+        size_t scan = 0;            // Every triangle before this has been emitted
+        int64 best = -1;
+
+        while (result.size() < triangleCount * 3)
+        {
+            // Nothing in the cache leads anywhere, restart from the next triangle in the input
+            if (best < 0)
+            {
+                while (emitted[scan])
+                {
+                    scan++;
+                }
+                best = (int64) scan;
+            }
+
+            const uint32* tri = &indices[best * 3];
+            emitted[best] = true;
+            result.insert(result.end(), tri, tri + 3);
+
+            // Remove the triangle from its vertices' adjacency
+            for (size_t corner = 0; corner < 3; corner++)
+            {
+                uint32 v = tri[corner];
+                uint32* begin = &adjacency[offsets[v]];
+                uint32* end = begin + remaining[v];
+                std::iter_swap(std::find(begin, end, (uint32) best), end - 1);
+                remaining[v]--;
+            }
+
+            // Move its vertices to the front of the LRU cache
+            nextCache.assign(tri, tri + 3);
+            for (uint32 v : cache)
+            {
+                if (v != tri[0] && v != tri[1] && v != tri[2])
+                {
+                    nextCache.push_back(v);
+                }
+            }
+            std::swap(cache, nextCache);
+
+            // Rescore every vertex that was or still is in the cache, along with their triangles
+            for (size_t i = 0; i < cache.size(); i++)
+            {
+                uint32 v = cache[i];
+                cachePosition[v] = i < VERTEX_CACHE_SIZE ? (int) i : -1;
+                vertexScore[v] = scores.get(cachePosition[v], remaining[v]);
+            }
+
+            best = -1;
+            float bestScore = 0.0f;
+            for (uint32 v : cache)
+            {
+                for (size_t i = offsets[v]; i < offsets[v] + remaining[v]; i++)
+                {
+                    uint32 t = adjacency[i];
+                    const uint32* other = &indices[t * 3];
+                    triangleScore[t] = vertexScore[other[0]] + vertexScore[other[1]] + vertexScore[other[2]];
+                    if (triangleScore[t] > bestScore)
+                    {
+                        best = t;
+                        bestScore = triangleScore[t];
+                    }
+                }
+            }
+
+            if (cache.size() > VERTEX_CACHE_SIZE)
+            {
+                cache.resize(VERTEX_CACHE_SIZE);
+            }
+        }
+
+        indices = std::move(result);
+    }
+
+    std::vector<uint32> optimizeVertexFetch(std::vector<uint32>& indices, size_t vertexCount)
+    {
+        constexpr uint32 UNUSED = ~(uint32) 0;
+        std::vector<uint32> remap(vertexCount, UNUSED);
+
+        uint32 next = 0;
+        for (uint32& index : indices)
+        {
+            if (remap[index] == UNUSED)
+            {
+                remap[index] = next++;
+            }
+            index = remap[index];
+        }
+
+        for (uint32& index : remap)
+        {
+            if (index == UNUSED)
+            {
+                index = next++;
+            }
+        }
+
+        return remap;
+    }
+
+    /// <summary>
+    /// Returns the given stream with the attributes of each vertex moved to their new index.
+    /// </summary>
+    static std::vector<float> remapStream(std::span<const float> stream, const std::vector<uint32>& remap, size_t components)
+    {
+        std::vector<float> result(stream.size());
+        for (size_t v = 0; v < remap.size() && !stream.empty(); v++)
+        {
+            std::copy_n(&stream[v * components], components, &result[remap[v] * components]);
+        }
+        return result;
+    }
+
+    MeshOptimizeStats optimizeMesh(Mesh* mesh)
+    {
+        MeshOptimizeStats stats;
+
+        size_t vertexCount = mesh->numVertices();
+        std::vector<uint32> indices(mesh->getIndices().begin(), mesh->getIndices().end());
+        stats.acmrBefore = computeACMR(indices, vertexCount);
+
+        optimizeVertexCache(indices, vertexCount);
+        stats.acmrAfter = computeACMR(indices, vertexCount);
+
+        std::vector<uint32> remap = optimizeVertexFetch(indices, vertexCount);
+        mesh->setPositions(remapStream(mesh->getPositions(), remap, 3));
+        mesh->setNormals(remapStream(mesh->getNormals(), remap, 3));
+        mesh->setUVs(remapStream(mesh->getUVs(), remap, 2));
+        mesh->setIndices(std::move(indices));
+        mesh->computeFaceData();
+
+        return stats;
+    }
+}
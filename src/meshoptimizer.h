@@ -0,0 +1,51 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <span>
+#include <vector>
+
+#include "core.h"
+#include "mesh.h"
+
+namespace Graphics
+{
+    constexpr size_t VERTEX_CACHE_SIZE = 32;        // LRU cache modelled while reordering triangles
+    constexpr size_t VERTEX_CACHE_FIFO_SIZE = 16;   // FIFO cache used to measure ACMR
+
+    /// <summary>
+    /// Average cache miss ratio before and after optimizing a mesh.
+    /// </summary>
+    struct MeshOptimizeStats
+    {
+        double acmrBefore = 0.0;
+        double acmrAfter = 0.0;
+    };
+
+    /// <summary>
+    /// Returns the average number of vertex cache misses per triangle when drawing the given
+    /// indices through a FIFO cache of the given size. 3.0 is the worst case, 0.5 is about the
+    /// best a regular grid can do.
+    /// </summary>
+    double computeACMR(std::span<const uint32> indices, size_t vertexCount, size_t cacheSize = VERTEX_CACHE_FIFO_SIZE);
+
+    /// <summary>
+    /// Reorders triangles so vertices are reused while they are still in the post-transform
+    /// cache (Tom Forsyth, "Linear-Speed Vertex Cache Optimisation").
+    /// </summary>
+    void optimizeVertexCache(std::vector<uint32>& indices, size_t vertexCount);
+
+    /// <summary>
+    /// Renumbers vertices in the order the indices first reference them and returns the new index
+    /// of every old vertex, so vertex streams are read close to linearly. Unreferenced vertices are
+    /// moved to the end.
+    /// </summary>
+    std::vector<uint32> optimizeVertexFetch(std::vector<uint32>& indices, size_t vertexCount);
+
+    /// <summary>
+    /// Runs the vertex cache and vertex fetch passes over the given mesh and rebuilds its per-face
+    /// data. The geometry is unchanged, only the order of triangles and vertices.
+    /// </summary>
+    MeshOptimizeStats optimizeMesh(Mesh* mesh);
+}
+
+#endif
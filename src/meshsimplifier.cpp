@@ -0,0 +1,436 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+
+#include "meshsimplifier.h"
+
+namespace Graphics
+{
+    constexpr size_t SIMPLIFY_CANCEL_INTERVAL = 1024;   // Vertices, triangles or collapses between checks of the cancel flag
+
+    using QuadricPoint = std::array<double, 3>;     // Positions are simplified in double precision
+
+    static inline QuadricPoint subtract(const QuadricPoint& a, const QuadricPoint& b)
+    {
+        return { a[0] - b[0], a[1] - b[1], a[2] - b[2] };
+    }
+
+    static inline QuadricPoint crossProduct(const QuadricPoint& a, const QuadricPoint& b)
+    {
+        return { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+    }
+
+    static inline double dotProduct(const QuadricPoint& a, const QuadricPoint& b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    /// <summary>
+    /// Symmetric 4x4 matrix summing the squared distances to a set of planes.
+    /// </summary>
+    struct Quadric
+    {
+        // a2, ab, ac, ad, b2, bc, bd, c2, cd, d2
+        std::array<double, 10> m = {};
+
+        Quadric() { };
+
+        /// <summary>
+        /// Quadric of the plane through the given point with the given unit normal.
+        /// </summary>
+        Quadric(const QuadricPoint& normal, const QuadricPoint& point, double weight)
+        {
+            double a = normal[0];
+            double b = normal[1];
+            double c = normal[2];
+            double d = -dotProduct(normal, point);
+            m = { a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d };
+            for (double& value : m)
+            {
+                value *= weight;
+            }
+        }
+
+        void operator += (const Quadric& other)
+        {
+            for (size_t i = 0; i < m.size(); i++)
+            {
+                m[i] += other.m[i];
+            }
+        }
+
+        double evaluate(const QuadricPoint& p) const
+        {
+            double x = p[0];
+            double y = p[1];
+            double z = p[2];
+            return m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x
+                 + m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y
+                 + m[7] * z * z + 2.0 * m[8] * z
+                 + m[9];
+        }
+    };
+
+    struct Collapse
+    {
+        double cost;
+        uint32 from;        // Removed
+        uint32 to;          // Kept, moved to position
+        QuadricPoint position;
+        uint32 fromVersion;
+        uint32 toVersion;
+
+        bool operator > (const Collapse& other) const { return cost > other.cost; }
+    };
+
+    Mesh* simplifyMesh(const Mesh* mesh, size_t targetTriangles, double& error, const std::atomic<bool>* cancel)
+    {
+        error = 0.0;
+
+        // Every phase checks the cancel flag as it goes, so a cancelled simplification stops
+        // about as quickly wherever it is
+        size_t steps = 0;
+        auto cancelled = [&]()
+        {
+            return cancel != nullptr && ++steps % SIMPLIFY_CANCEL_INTERVAL == 0 && cancel->load(std::memory_order_relaxed);
+        };
+
+        // Weld vertices that share a position exactly, keeping the first as the representative
+        std::vector<uint32> weld(mesh->numVertices());
+        std::vector<uint32> representative;
+        std::vector<QuadricPoint> positions;
+        {
+            std::unordered_map<uint64, std::vector<uint32>> buckets;
+            std::span<const float> source = mesh->getPositions();
+            for (uint32 v = 0; v < mesh->numVertices(); v++)
+            {
+                if (cancelled())
+                {
+                    return nullptr;
+                }
+
+                uint32 bits[3];
+                memcpy(bits, &source[v * 3], sizeof(bits));
+                uint64 key = ((uint64) bits[0] * 73856093ull) ^ ((uint64) bits[1] * 19349663ull) ^ ((uint64) bits[2] * 83492791ull);
+
+                std::vector<uint32>& bucket = buckets[key];
+                auto match = std::find_if(bucket.begin(), bucket.end(), [&](uint32 other)
+                {
+                    return memcmp(&source[representative[other] * 3], &source[v * 3], sizeof(bits)) == 0;
+                });
+
+                if (match == bucket.end())
+                {
+                    weld[v] = (uint32) positions.size();
+                    bucket.push_back(weld[v]);
+                    representative.push_back(v);
+                    positions.push_back({ source[v * 3], source[v * 3 + 1], source[v * 3 + 2] });
+                }
+                else
+                {
+                    weld[v] = *match;
+                }
+            }
+        }
+        size_t vertexCount = positions.size();
+
+        // Welded triangles, without the ones that were degenerate to begin with
+        std::vector<std::array<uint32, 3>> triangles;
+        std::vector<uint32> inputTriangles;      // Which input triangle each one was
+        triangles.reserve(mesh->numTriangles());
+        inputTriangles.reserve(mesh->numTriangles());
+        for (size_t t = 0; t < mesh->numTriangles(); t++)
+        {
+            if (cancelled())
+            {
+                return nullptr;
+            }
+
+            std::array<uint32, 3> tri = { weld[mesh->getIndex(t * 3)], weld[mesh->getIndex(t * 3 + 1)], weld[mesh->getIndex(t * 3 + 2)] };
+            if (tri[0] != tri[1] && tri[1] != tri[2] && tri[2] != tri[0])
+            {
+                triangles.push_back(tri);
+                inputTriangles.push_back((uint32) t);
+            }
+        }
+        std::vector<bool> removed(triangles.size(), false);
+        size_t triangleCount = triangles.size();
+
+        // Vertex quadrics from the planes of their triangles, and triangle adjacency
+        std::vector<Quadric> quadrics(vertexCount);
+        std::vector<std::vector<uint32>> adjacency(vertexCount);
+        std::unordered_map<uint64, int> edgeUses;
+        for (uint32 t = 0; t < triangles.size(); t++)
+        {
+            if (cancelled())
+            {
+                return nullptr;
+            }
+
+            const std::array<uint32, 3>& tri = triangles[t];
+            QuadricPoint normal = crossProduct(subtract(positions[tri[1]], positions[tri[0]]), subtract(positions[tri[2]], positions[tri[0]]));
+            double length = std::sqrt(dotProduct(normal, normal));
+            if (length > 0.0)
+            {
+                normal = { normal[0] / length, normal[1] / length, normal[2] / length };
+            }
+
+            Quadric plane(normal, positions[tri[0]], 1.0);
+            for (uint32 v : tri)
+            {
+                quadrics[v] += plane;
+                adjacency[v].push_back(t);
+            }
+            for (size_t i = 0; i < 3; i++)
+            {
+                uint32 a = std::min(tri[i], tri[(i + 1) % 3]);
+                uint32 b = std::max(tri[i], tri[(i + 1) % 3]);
+                edgeUses[(uint64) a << 32 | b]++;
+            }
+        }
+
+        // Open borders get an extra plane through the edge, perpendicular to its triangle, so they
+        // keep their outline
+        for (const std::array<uint32, 3>& tri : triangles)
+        {
+            if (cancelled())
+            {
+                return nullptr;
+            }
+
+            QuadricPoint normal = crossProduct(subtract(positions[tri[1]], positions[tri[0]]), subtract(positions[tri[2]], positions[tri[0]]));
+            for (size_t i = 0; i < 3; i++)
+            {
+                uint32 a = tri[i];
+                uint32 b = tri[(i + 1) % 3];
+                if (edgeUses[(uint64) std::min(a, b) << 32 | std::max(a, b)] != 1)
+                {
+                    continue;
+                }
+
+                QuadricPoint edge = subtract(positions[b], positions[a]);
+                QuadricPoint border = crossProduct(edge, normal);
+                double length = std::sqrt(dotProduct(border, border));
+                if (length > 0.0)
+                {
+                    border = { border[0] / length, border[1] / length, border[2] / length };
+                    Quadric plane(border, positions[a], SIMPLIFY_BOUNDARY_WEIGHT);
+                    quadrics[a] += plane;
+                    quadrics[b] += plane;
+                }
+            }
+        }
+        edgeUses.clear();
+
+        std::vector<uint32> versions(vertexCount, 0);
+        std::vector<bool> alive(vertexCount, true);
+
+        // Of the two end points and the midpoint, collapse to whichever the quadrics like best
+        auto makeCollapse = [&](uint32 from, uint32 to)
+        {
+            Quadric q = quadrics[from];
+            q += quadrics[to];
+
+            const QuadricPoint& a = positions[from];
+            const QuadricPoint& b = positions[to];
+            QuadricPoint mid = { (a[0] + b[0]) * 0.5, (a[1] + b[1]) * 0.5, (a[2] + b[2]) * 0.5 };
+
+            Collapse collapse = { q.evaluate(b), from, to, b, versions[from], versions[to] };
+            for (const QuadricPoint& candidate : { a, mid })
+            {
+                double cost = q.evaluate(candidate);
+                if (cost < collapse.cost)
+                {
+                    collapse.cost = cost;
+                    collapse.position = candidate;
+                }
+            }
+            collapse.cost = std::max(collapse.cost, 0.0);
+            return collapse;
+        };
+
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+        for (const std::array<uint32, 3>& tri : triangles)
+        {
+            if (cancelled())
+            {
+                return nullptr;
+            }
+
+            for (size_t i = 0; i < 3; i++)
+            {
+                // Interior edges show up once in each direction, only queue one of them
+                if (tri[i] < tri[(i + 1) % 3])
+                {
+                    heap.push(makeCollapse(tri[i], tri[(i + 1) % 3]));
+                }
+            }
+        }
+
+        // Whether moving a vertex would turn any triangle around it over
+        auto flips = [&](uint32 moved, uint32 other, const QuadricPoint& position)
+        {
+            for (uint32 t : adjacency[moved])
+            {
+                const std::array<uint32, 3>& tri = triangles[t];
+                if (removed[t] || std::find(tri.begin(), tri.end(), other) != tri.end())
+                {
+                    continue;
+                }
+
+                QuadricPoint corners[3] = { positions[tri[0]], positions[tri[1]], positions[tri[2]] };
+                QuadricPoint before = crossProduct(subtract(corners[1], corners[0]), subtract(corners[2], corners[0]));
+                if (dotProduct(before, before) == 0.0)
+                {
+                    continue;
+                }
+                for (size_t i = 0; i < 3; i++)
+                {
+                    if (tri[i] == moved)
+                    {
+                        corners[i] = position;
+                    }
+                }
+                QuadricPoint after = crossProduct(subtract(corners[1], corners[0]), subtract(corners[2], corners[0]));
+                if (dotProduct(before, after) <= 0.0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        double maxCost = 0.0;
+        while (triangleCount > targetTriangles && !heap.empty())
+        {
+            if (cancelled())
+            {
+                return nullptr;
+            }
+
+            Collapse collapse = heap.top();
+            heap.pop();
+
+            // Stale entries are skipped, their vertices have moved since they were queued
+            uint32 from = collapse.from;
+            uint32 to = collapse.to;
+            if (!alive[from] || !alive[to] || versions[from] != collapse.fromVersion || versions[to] != collapse.toVersion)
+            {
+                continue;
+            }
+
+            if (flips(from, to, collapse.position) || flips(to, from, collapse.position))
+            {
+                continue;
+            }
+
+            // Move the kept vertex and hand it every triangle of the removed one
+            positions[to] = collapse.position;
+            quadrics[to] += quadrics[from];
+            alive[from] = false;
+            versions[to]++;
+            maxCost = std::max(maxCost, collapse.cost);
+
+            for (uint32 t : adjacency[from])
+            {
+                if (removed[t])
+                {
+                    continue;
+                }
+
+                std::array<uint32, 3>& tri = triangles[t];
+                if (std::find(tri.begin(), tri.end(), to) != tri.end())
+                {
+                    removed[t] = true;
+                    triangleCount--;
+                }
+                else
+                {
+                    std::replace(tri.begin(), tri.end(), from, to);
+                    adjacency[to].push_back(t);
+                }
+            }
+            adjacency[from].clear();
+
+            std::vector<uint32>& around = adjacency[to];
+            around.erase(std::remove_if(around.begin(), around.end(), [&](uint32 t) { return removed[t]; }), around.end());
+
+            // Requeue every edge of the kept vertex with its new position and quadric
+            for (uint32 t : around)
+            {
+                for (uint32 v : triangles[t])
+                {
+                    if (v != to)
+                    {
+                        heap.push(makeCollapse(v, to));
+                    }
+                }
+            }
+        }
+
+        error = std::sqrt(maxCost);
+
+        // Compact the surviving vertices, taking attributes from each one's representative
+        std::vector<uint32> remap(vertexCount, ~(uint32) 0);
+        std::vector<float> outPositions;
+        std::vector<float> outNormals;
+        std::vector<float> outUVs;
+        std::vector<uint32> outIndices;
+        std::vector<uint32> outSources;
+        outIndices.reserve(triangleCount * 3);
+        outSources.reserve(triangleCount);
+
+        // Each surviving triangle is an input triangle with moved corners, so it keeps that one's
+        // source; levels simplified from other levels map straight back to the full mesh
+        std::span<const uint32> sources = mesh->getSourceTriangles();
+
+        std::span<const float> normals = mesh->getNormals();
+        std::span<const float> uvs = mesh->getUVs();
+        for (size_t t = 0; t < triangles.size(); t++)
+        {
+            if (removed[t])
+            {
+                continue;
+            }
+
+            uint32 input = inputTriangles[t];
+            outSources.push_back(sources.empty() ? input : sources[input]);
+            for (uint32 v : triangles[t])
+            {
+                if (remap[v] == ~(uint32) 0)
+                {
+                    remap[v] = (uint32) (outPositions.size() / 3);
+                    uint32 source = representative[v];
+                    for (size_t axis = 0; axis < 3; axis++)
+                    {
+                        outPositions.push_back((float) positions[v][axis]);
+                        if (!normals.empty())
+                        {
+                            outNormals.push_back(normals[source * 3 + axis]);
+                        }
+                    }
+                    if (!uvs.empty())
+                    {
+                        outUVs.push_back(uvs[source * 2]);
+                        outUVs.push_back(uvs[source * 2 + 1]);
+                    }
+                }
+                outIndices.push_back(remap[v]);
+            }
+        }
+
+        Mesh* result = new Mesh();
+        result->setPositions(std::move(outPositions));
+        result->setNormals(std::move(outNormals));
+        result->setUVs(std::move(outUVs));
+        result->setIndices(std::move(outIndices));
+        result->setSourceTriangles(std::move(outSources));
+        result->computeFaceData();
+        result->computeBounds();
+
+        return result;
+    }
+}
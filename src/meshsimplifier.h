@@ -0,0 +1,31 @@
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include <atomic>
+
+#include "core.h"
+#include "mesh.h"
+
+namespace Graphics
+{
+    constexpr double SIMPLIFY_BOUNDARY_WEIGHT = 10.0;   // How strongly open borders resist collapsing
+
+    /// <summary>
+    /// Reduces the given mesh to about the target number of triangles by repeatedly collapsing the
+    /// edge whose quadric error is lowest (Garland and Heckbert, "Surface Simplification Using
+    /// Quadric Error Metrics"). Vertices sharing a position are welded first so attribute seams
+    /// don't tear open. Collapses that would flip a triangle are skipped, so the result can stay
+    /// above the target.
+    /// </summary>
+    /// <param name="mesh">The mesh to simplify. It is not modified.</param>
+    /// <param name="targetTriangles">The number of triangles to stop at.</param>
+    /// <param name="error">Receives an upper estimate of how far, in object space, the result
+    /// strays from the input.</param>
+    /// <param name="cancel">Optional. Simplification stops early and returns nullptr once this
+    /// is set.</param>
+    /// <returns>The new mesh, owned by the caller.</returns>
+    Mesh* simplifyMesh(const Mesh* mesh, size_t targetTriangles, double& error,
+                       const std::atomic<bool>* cancel = nullptr);
+}
+
+#endif
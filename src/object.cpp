@@ -5,7 +5,7 @@ using namespace Graphics;
 
 void Object::move(const Vector3& v)
 {
-	m_transform.setTranslation(m_transform.getTranslation() + v);
+	setTranslation(getTranslation() + v);
 }
 
 }
\ No newline at end of file
@@ -2,46 +2,87 @@
 #define OBJECT_H
 
 #include "transform.h"
+#include "transformstorage.h"
 
 namespace Graphics {
 using namespace Graphics;
 
+/// <summary>
+/// Handle to a transform in the shared TransformStorage. Copying an object copies its transform
+/// into a transform of its own.
+/// </summary>
 class Object
 {
 public:
-	Object() {};
+	Object() : m_transform(TransformStorage::get().create()) {};
+	Object(const Object& other) : Object() { copyTransform(other); }
+	Object& operator=(const Object& other)
+	{
+		copyTransform(other);
+		return *this;
+	}
+	~Object() { TransformStorage::get().destroy(m_transform); }
 
-	const Transform getTransform() { return m_transform; }
-	void setTransform(Transform t) { m_transform = t; }
+	TransformId getTransformId() const { return m_transform; }
+
+	const Transform getTransform() const
+	{
+		Transform t;
+		t.setTranslation(getTranslation());
+		t.setRotation(getRotation());
+		t.setScale(getScale());
+		return t;
+	}
+	void setTransform(Transform t)
+	{
+		setTranslation(t.getTranslation());
+		setRotation(t.getRotation());
+		setScale(t.getScale());
+	}
 
-	const Vector3 getTranslation() { return m_transform.getTranslation(); }
-	const Rotation getRotation() { return m_transform.getRotation(); }
-	const Vector3 getScale() { return m_transform.getScale(); }
+	const Vector3 getTranslation() const { return TransformStorage::get().getTranslation(m_transform); }
+	const Rotation getRotation() const { return TransformStorage::get().getRotation(m_transform); }
+	const Vector3 getScale() const { return TransformStorage::get().getScale(m_transform); }
 
-	const Vector3 getForward() { return m_transform.getForward(); }
-	const Vector3 getRight() { return m_transform.getRight(); }
-	const Vector3 getUp() { return m_transform.getUp(); }
+	const Vector3 getForward() const { return getAxis(1); }
+	const Vector3 getRight() const { return getAxis(0); }
+	const Vector3 getUp() const { return getAxis(2); }
 
-	void setTranslation(const Vector3& t) { m_transform.setTranslation(t); }
-	void setRotation(const Rotation& r) { m_transform.setRotation(r); }
+	void setTranslation(const Vector3& t) { TransformStorage::get().setTranslation(m_transform, t); }
+	void setRotation(const Rotation& r) { TransformStorage::get().setRotation(m_transform, r); }
+	void setScale(const Vector3& s) { TransformStorage::get().setScale(m_transform, s); }
 
 	void addTranslation(const Vector3& t)
 	{
-		Vector3 newTranslation = m_transform.getTranslation() + t;
-		m_transform.setTranslation(newTranslation);
+		setTranslation(getTranslation() + t);
 	}
 	void addRotation(const Rotation& r)
 	{
-		Rotation newRotation = m_transform.getRotation() + r;
-		m_transform.setRotation(newRotation);
+		Rotation newRotation = getRotation() + r;
+		setRotation(newRotation);
 	}
 
 	void move(const Vector3& v);
 
 protected:
-	Transform m_transform = Transform();
+	TransformId m_transform;
+
+private:
+	void copyTransform(const Object& other)
+	{
+		setTranslation(other.getTranslation());
+		setRotation(other.getRotation());
+		setScale(other.getScale());
+	}
+
+	// Row of the rotation, matching Transform's getRight/getForward/getUp
+	Vector3 getAxis(int row) const
+	{
+		Matrix4 m = TransformStorage::get().computeMatrix(m_transform);
+		return { m[row][0], m[row][1], m[row][2] };
+	}
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
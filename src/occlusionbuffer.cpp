@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "occlusionbuffer.h"
+#include "parallel.h"
+#include "trianglesetup.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+/// <summary>
+/// Returns the occlusion pixel holding the framebuffer pixel that samples the given screen
+/// coordinate, clamped to just outside a buffer of the given size.
+/// </summary>
+static int toPixel(double screen, int size)
+{
+    double pixel = std::floor((screen - 1.0) / OCCLUSION_BUFFER_SCALE);
+    return (int) std::clamp(pixel, -1.0, (double) size);
+}
+
+void OcclusionBuffer::begin(const Matrix4& viewProj, int frameWidth, int frameHeight)
+{
+    m_viewProj = viewProj;
+
+    // The view is rigid and the projection only scales x and y, so each of the first two rows
+    // is the camera axis times the projection's scale
+    m_focalX = Vector3(viewProj[0][0], viewProj[0][1], viewProj[0][2]).length() * frameWidth * 0.5;
+    m_focalY = Vector3(viewProj[1][0], viewProj[1][1], viewProj[1][2]).length() * frameHeight * 0.5;
+    m_frameWidth = frameWidth;
+    m_frameHeight = frameHeight;
+    m_width = (frameWidth + OCCLUSION_BUFFER_SCALE - 1) / OCCLUSION_BUFFER_SCALE;
+    m_height = (frameHeight + OCCLUSION_BUFFER_SCALE - 1) / OCCLUSION_BUFFER_SCALE;
+    m_depth.assign((size_t) m_width * m_height, FLT_MAX);
+}
+
+double OcclusionBuffer::project(const Matrix4& m, const Vector3& p, double& x, double& y) const
+{
+    // The projection gives points in front of the camera a negative w, equal to minus their depth
+    double clipX = m[0][0] * p._x + m[0][1] * p._y + m[0][2] * p._z + m[0][3];
+    double clipY = m[1][0] * p._x + m[1][1] * p._y + m[1][2] * p._z + m[1][3];
+    double clipW = m[3][0] * p._x + m[3][1] * p._y + m[3][2] * p._z + m[3][3];
+    if (clipW == 0.0)
+    {
+        return 0.0;
+    }
+
+    x = (clipX / clipW + 1.0) * m_frameWidth * 0.5;
+    y = (clipY / clipW + 1.0) * m_frameHeight * 0.5;
+    return -clipW;
+}
+
+void OcclusionBuffer::drawOccluder(const MeshView& mesh, const Matrix4& model, double error)
+{
+    Matrix4 m = m_viewProj * model;
+
+    // Scale the error to world space by the model's largest axis scale
+    double scale = 0.0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        scale = std::max(scale, Vector3(model[0][axis], model[1][axis], model[2][axis]).length());
+    }
+    error *= scale;
+
+    m_projected.resize(mesh.numVertices());
+    parallelFor(mesh.numVertices(), MESH_PARALLEL_BATCH_SIZE, [&](size_t first, size_t last)
+    {
+        for (size_t v = first; v < last; v++)
+        {
+            double x = 0.0;
+            double y = 0.0;
+            double depth = project(m, mesh.getPosition((uint32) v), x, y);
+            m_projected[v] = Vector3(x, y, depth > OCCLUSION_MIN_DEPTH ? 1.0 / depth : 0.0);
+        }
+    });
+
+    for (size_t i = 0; i < mesh.numTriangles(); i++)
+    {
+        const Vector3& v1 = m_projected[mesh.indices[i * 3]];
+        const Vector3& v2 = m_projected[mesh.indices[i * 3 + 1]];
+        const Vector3& v3 = m_projected[mesh.indices[i * 3 + 2]];
+        if (v1._z <= 0.0 || v2._z <= 0.0 || v3._z <= 0.0)
+        {
+            continue;
+        }
+
+        double inset = error > 0.0 ? getScreenError(v1, v2, v3, error) : 0.0;
+        if (inset >= 0.0)
+        {
+            drawTriangle(v1, v2, v3, inset, error);
+        }
+    }
+}
+
+double OcclusionBuffer::getScreenError(const Vector3& v1, const Vector3& v2, const Vector3& v3, double error) const
+{
+    // A point at view offset (x, y) and depth z lands focal * x / z from the screen center.
+    // Moving it by up to error moves that by at most error * sqrt(focal^2 + offset^2) / z in
+    // pixels, largest where the triangle is nearest and furthest off center.
+    double depth = 1.0 / std::max({ v1._z, v2._z, v3._z }) - error;
+    if (depth <= OCCLUSION_MIN_DEPTH)
+    {
+        return -1.0;
+    }
+
+    double centerX = m_frameWidth * 0.5;
+    double centerY = m_frameHeight * 0.5;
+    double offsetX = std::max({ std::abs(v1._x - centerX), std::abs(v2._x - centerX), std::abs(v3._x - centerX) });
+    double offsetY = std::max({ std::abs(v1._y - centerY), std::abs(v2._y - centerY), std::abs(v3._y - centerY) });
+    return error * std::sqrt(m_focalX * m_focalX + m_focalY * m_focalY + offsetX * offsetX + offsetY * offsetY) / depth;
+}
+
+void OcclusionBuffer::drawTriangle(const Vector3& v1, const Vector3& v2, const Vector3& v3, double inset, double depthOffset)
+{
+    TriangleSetup t;
+    if (!setupTriangle(v1, v2, v3, t))
+    {
+        return;
+    }
+
+    // Move the edges inward by the inset; e / |(A, B)| is the distance from an edge
+    for (int e = 0; e < 3; e++)
+    {
+        t.edgeC[e] -= inset * std::sqrt(t.edgeA[e] * t.edgeA[e] + t.edgeB[e] * t.edgeB[e]);
+    }
+
+    // Occlusion pixels that may lie inside the triangle. Framebuffer pixel x samples the point x + 1.
+    int x0 = std::max(toPixel(t.minX, m_width), 0);
+    int y0 = std::max(toPixel(t.minY, m_height), 0);
+    int x1 = std::min(toPixel(t.maxX, m_width), m_width - 1);
+    int y1 = std::min(toPixel(t.maxY, m_height), m_height - 1);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        // The sample points of the framebuffer pixels this row covers
+        double top = y * OCCLUSION_BUFFER_SCALE + 1.0;
+        double bottom = std::min(y * OCCLUSION_BUFFER_SCALE + OCCLUSION_BUFFER_SCALE, m_frameHeight);
+        for (int x = x0; x <= x1; x++)
+        {
+            double left = x * OCCLUSION_BUFFER_SCALE + 1.0;
+            double right = std::min(x * OCCLUSION_BUFFER_SCALE + OCCLUSION_BUFFER_SCALE, m_frameWidth);
+
+            // Linear functions are smallest at a corner; the pixel is covered when every edge
+            // function is non-negative at its worst corner
+            bool covered = true;
+            for (int e = 0; e < 3 && covered; e++)
+            {
+                double worst = t.edgeA[e] * (t.edgeA[e] >= 0.0 ? left : right) +
+                               t.edgeB[e] * (t.edgeB[e] >= 0.0 ? top : bottom) + t.edgeC[e];
+                covered = worst >= 0.0;
+            }
+            if (!covered)
+            {
+                continue;
+            }
+
+            // The furthest depth over the pixel is where the inverse depth is smallest
+            double inverseDepth = t.getInverseDepth(t.depthA >= 0.0 ? left : right, t.depthB >= 0.0 ? top : bottom);
+            if (inverseDepth <= 0.0)
+            {
+                continue;
+            }
+
+            float& depth = m_depth[(size_t) y * m_width + x];
+            depth = std::min(depth, (float) (1.0 / inverseDepth + depthOffset));
+        }
+    }
+}
+
+bool OcclusionBuffer::isOccluded(const BoundingBox& bounds, const Matrix4& model) const
+{
+    if (bounds.isEmpty() || m_depth.empty())
+    {
+        return false;
+    }
+
+    // Screen rectangle and nearest depth of the box, from its corners
+    Matrix4 m = m_viewProj * model;
+    const Vector3& min = bounds.getMin();
+    const Vector3& max = bounds.getMax();
+    double minX = DBL_MAX, minY = DBL_MAX, maxX = -DBL_MAX, maxY = -DBL_MAX;
+    double nearest = DBL_MAX;
+    for (int i = 0; i < 8; i++)
+    {
+        Vector3 corner(i & 1 ? max._x : min._x, i & 2 ? max._y : min._y, i & 4 ? max._z : min._z);
+        double x = 0.0;
+        double y = 0.0;
+        double depth = project(m, corner, x, y);
+        if (depth <= OCCLUSION_MIN_DEPTH)
+        {
+            return false;
+        }
+
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+        nearest = std::min(nearest, depth);
+    }
+
+    int x0 = std::max(toPixel(minX, m_width), 0);
+    int y0 = std::max(toPixel(minY, m_height), 0);
+    int x1 = std::min(toPixel(maxX, m_width), m_width - 1);
+    int y1 = std::min(toPixel(maxY, m_height), m_height - 1);
+    if (x0 > x1 || y0 > y1)
+    {
+        // Off screen; that is for frustum culling to decide
+        return false;
+    }
+
+    for (int y = y0; y <= y1; y++)
+    {
+        const float* row = &m_depth[(size_t) y * m_width];
+        for (int x = x0; x <= x1; x++)
+        {
+            if (row[x] >= nearest)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+}
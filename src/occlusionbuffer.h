@@ -0,0 +1,92 @@
+#ifndef OCCLUSIONBUFFER_H
+#define OCCLUSIONBUFFER_H
+
+#include <vector>
+
+#include "api.h"
+#include "boundingbox.h"
+#include "matrix.h"
+#include "mesh.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+constexpr int OCCLUSION_BUFFER_SCALE = 4;		// Framebuffer pixels per occlusion pixel, on each axis
+constexpr size_t OCCLUSION_MAX_OCCLUDERS = 16;	// Nearest objects drawn as occluders each frame
+constexpr double OCCLUSION_MIN_DEPTH = 1e-6;	// Closer than this, geometry is treated as crossing the eye
+
+/// <summary>
+/// Low resolution depth buffer for rejecting whole objects before their triangles are drawn.
+/// Occluders are rasterized first; a pixel only takes an occluder's depth when the occluder
+/// covers all the framebuffer pixels inside it, and then the furthest depth it has there. An
+/// object is occluded when every pixel under its screen rectangle is covered by something nearer
+/// than the nearest corner of its box, so the test never hides anything that would be drawn.
+/// Occluders that only approximate their object, such as simplified levels, are given their
+/// error and drawn shrunk and pushed back by it, which keeps that true. Depths are view-space
+/// distances, kept apart from the framebuffer's Z channel.
+/// </summary>
+class OcclusionBuffer
+{
+	int m_width = 0;
+	int m_height = 0;
+	int m_frameWidth = 0;
+	int m_frameHeight = 0;
+	Matrix4 m_viewProj;
+	double m_focalX = 0.0;						// Pixels per unit of x / depth, from the projection
+	double m_focalY = 0.0;
+
+	std::vector<float> m_depth;
+	std::vector<Vector3> m_projected;			// Screen x, y and inverse depth of the occluder being drawn
+
+	/// <summary>
+	/// Projects a point through the given projection * view * model matrix to framebuffer
+	/// coordinates, and returns its view depth.
+	/// </summary>
+	double project(const Matrix4& m, const Vector3& p, double& x, double& y) const;
+
+	/// <summary>
+	/// Returns how far, in framebuffer pixels, any point within the given distance of the
+	/// triangle can project from it, or a negative value if such a point can reach the eye.
+	/// </summary>
+	double getScreenError(const Vector3& v1, const Vector3& v2, const Vector3& v3, double error) const;
+
+	/// <summary>
+	/// Draws a triangle shrunk by the given number of pixels and pushed back by the given depth.
+	/// </summary>
+	void drawTriangle(const Vector3& v1, const Vector3& v2, const Vector3& v3, double inset, double depthOffset);
+
+public:
+	OcclusionBuffer() {};
+
+	int getWidth() const { return m_width; }
+	int getHeight() const { return m_height; }
+
+	/// <summary>
+	/// Returns the depth behind which everything is hidden at the given occlusion pixel.
+	/// </summary>
+	float getDepth(int x, int y) const { return m_depth[(size_t) y * m_width + x]; }
+
+	/// <summary>
+	/// Clears the buffer for a new frame, sized to cover a framebuffer of the given size.
+	/// </summary>
+	/// <param name="viewProj">The projection matrix times the view matrix.</param>
+	void begin(const Matrix4& viewProj, int frameWidth, int frameHeight);
+
+	/// <summary>
+	/// Rasterizes every triangle of the given mesh as an occluder. Both windings are drawn.
+	/// Triangles reaching behind the eye are skipped.
+	/// </summary>
+	/// <param name="error">How far, in object space, the mesh may stray from the object it
+	/// stands in for.</param>
+	void drawOccluder(const MeshView& mesh, const Matrix4& model, double error = 0.0);
+
+	/// <summary>
+	/// Returns whether the given object-space box is hidden behind the occluders drawn so far.
+	/// Boxes crossing the eye plane are never occluded.
+	/// </summary>
+	bool isOccluded(const BoundingBox& bounds, const Matrix4& model) const;
+};
+
+}
+
+#endif
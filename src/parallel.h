@@ -0,0 +1,188 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Graphics {
+using namespace Graphics;
+
+/// <summary>
+/// Returns the number of threads parallel work should be split across.
+/// </summary>
+inline size_t getThreadCount()
+{
+	size_t count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+/// <summary>
+/// Worker threads shared by every parallelFor(), started once instead of on every call. A thread
+/// waiting for its own tasks runs queued ones meanwhile, so tasks may themselves call
+/// parallelFor() and several threads may use the pool at once.
+/// </summary>
+class ThreadPool
+{
+	struct Task
+	{
+		const std::function<void(size_t)>* func;
+		size_t index;
+		size_t* remaining;		// Tasks of its run() still to finish, guarded by m_mutex
+	};
+
+	std::mutex m_mutex;
+	std::condition_variable m_queued;		// A task was queued
+	std::condition_variable m_finished;		// The last task of a run() finished
+	std::deque<Task> m_tasks;
+	std::vector<std::thread> m_workers;
+
+	/// <summary>
+	/// Runs the oldest queued task, if there is one. The lock is held on entry and on return.
+	/// </summary>
+	bool runQueued(std::unique_lock<std::mutex>& lock)
+	{
+		if (m_tasks.empty())
+		{
+			return false;
+		}
+
+		Task task = m_tasks.front();
+		m_tasks.pop_front();
+		lock.unlock();
+		(*task.func)(task.index);
+		lock.lock();
+
+		if (--*task.remaining == 0)
+		{
+			m_finished.notify_all();
+		}
+		return true;
+	}
+
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_queued.wait(lock, [this] { return !m_tasks.empty(); });
+			runQueued(lock);
+		}
+	}
+
+public:
+	ThreadPool(size_t workerCount)
+	{
+		for (size_t i = 0; i < workerCount; i++)
+		{
+			m_workers.emplace_back(&ThreadPool::work, this);
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/// <summary>
+	/// Calls func(index) for every index in [0, count), spread over the workers, and returns
+	/// once all calls have finished. The calling thread runs the last one. func must not throw.
+	/// </summary>
+	void run(size_t count, const std::function<void(size_t)>& func)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+
+		size_t remaining = count - 1;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (size_t i = 0; i + 1 < count; i++)
+			{
+				m_tasks.push_back({ &func, i, &remaining });
+			}
+		}
+		m_queued.notify_all();
+
+		func(count - 1);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (remaining > 0)
+		{
+			if (!runQueued(lock))
+			{
+				m_finished.wait(lock);
+			}
+		}
+	}
+};
+
+/// <summary>
+/// Returns the pool parallelFor() runs on, with a worker for every hardware thread but the caller's.
+/// </summary>
+inline ThreadPool& getThreadPool()
+{
+	// Never destroyed, so threads still running during static destruction can keep using it
+	static ThreadPool* pool = new ThreadPool(getThreadCount() - 1);
+	return *pool;
+}
+
+/// <summary>
+/// Splits the range [0, count) into contiguous batches and runs them concurrently on the shared
+/// thread pool, one batch per hardware thread. The calling thread runs the last batch. If any
+/// batch throws, the first exception is rethrown once every batch has finished.
+/// </summary>
+/// <param name="count">The number of items to process.</param>
+/// <param name="minBatchSize">The smallest number of items worth handing to a thread.</param>
+/// <param name="func">Called as func(begin, end) for each batch.</param>
+template<typename Func>
+void parallelFor(size_t count, size_t minBatchSize, Func&& func)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	size_t batchSize = std::max((count + getThreadCount() - 1) / getThreadCount(), std::max<size_t>(minBatchSize, 1));
+	size_t batchCount = (count + batchSize - 1) / batchSize;
+
+	std::vector<std::exception_ptr> errors(batchCount);
+	std::function<void(size_t)> runBatch = [&](size_t batch)
+	{
+		size_t begin = batch * batchSize;
+		size_t end = std::min(begin + batchSize, count);
+		try
+		{
+			func(begin, end);
+		}
+		catch (...)
+		{
+			errors[batch] = std::current_exception();
+		}
+	};
+
+	if (batchCount == 1)
+	{
+		runBatch(0);
+	}
+	else
+	{
+		getThreadPool().run(batchCount, runBatch);
+	}
+
+	for (auto& error : errors)
+	{
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdexcept>
+
+#include "scene.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+SceneNodeId Scene::addNode(Object* object, SceneNodeId parent)
+{
+    SceneNodeId id = (SceneNodeId) m_nodes.size();
+    m_nodes.emplace_back();
+    m_nodes[id].object = object;
+    link(id, parent);
+
+    // New nodes start dirty
+    m_dirty.push_back(id);
+    return id;
+}
+
+void Scene::setParent(SceneNodeId id, SceneNodeId parent)
+{
+    for (SceneNodeId ancestor = parent; ancestor != SCENE_NO_NODE; ancestor = m_nodes[ancestor].parent)
+    {
+        if (ancestor == id)
+        {
+            throw std::runtime_error("Scene node cannot be parented under itself or a descendant");
+        }
+    }
+
+    unlink(id);
+    link(id, parent);
+
+    // The local matrix is unchanged but the world matrix now has a different parent
+    if (!m_nodes[id].dirty)
+    {
+        m_dirty.push_back(id);
+    }
+    m_nodes[id].dirty = true;
+}
+
+void Scene::setBounds(SceneNodeId id, const BoundingBox& bounds)
+{
+    Node& node = m_nodes[id];
+    if (node.bounds == bounds)
+    {
+        return;
+    }
+
+    node.bounds = bounds;
+    if (bounds.isEmpty() && node.proxy != SPATIAL_NO_PROXY)
+    {
+        m_index.remove(node.proxy);
+        node.proxy = SPATIAL_NO_PROXY;
+    }
+
+    // The index is brought up to date with the world matrix in update()
+    markDirty(id);
+}
+
+void Scene::link(SceneNodeId id, SceneNodeId parent)
+{
+    Node& node = m_nodes[id];
+    node.parent = parent;
+    if (parent != SCENE_NO_NODE)
+    {
+        node.nextSibling = m_nodes[parent].firstChild;
+        m_nodes[parent].firstChild = id;
+    }
+}
+
+void Scene::unlink(SceneNodeId id)
+{
+    Node& node = m_nodes[id];
+    if (node.parent != SCENE_NO_NODE)
+    {
+        SceneNodeId* slot = &m_nodes[node.parent].firstChild;
+        while (*slot != id)
+        {
+            slot = &m_nodes[*slot].nextSibling;
+        }
+        *slot = node.nextSibling;
+    }
+    node.parent = SCENE_NO_NODE;
+    node.nextSibling = SCENE_NO_NODE;
+}
+
+void Scene::update()
+{
+    // Only the topmost dirty nodes need walking; the rest are inside one of their subtrees
+    std::vector<SceneNodeId> roots;
+    for (SceneNodeId id : m_dirty)
+    {
+        bool covered = false;
+        for (SceneNodeId ancestor = m_nodes[id].parent; ancestor != SCENE_NO_NODE && !covered; ancestor = m_nodes[ancestor].parent)
+        {
+            covered = m_nodes[ancestor].dirty;
+        }
+        if (!covered)
+        {
+            roots.push_back(id);
+        }
+    }
+
+    // When a large part of the scene moved, one pass over all transforms beats converting them
+    // one at a time
+    TransformStorage& transforms = TransformStorage::get();
+    bool batch = m_dirty.size() >= SCENE_BATCH_MIN_DIRTY && m_dirty.size() * 4 >= transforms.size();
+    if (batch)
+    {
+        transforms.updateMatrices();
+    }
+    m_dirty.clear();
+
+    std::vector<SceneNodeId> stack;
+    for (SceneNodeId root : roots)
+    {
+        stack.push_back(root);
+        while (!stack.empty())
+        {
+            SceneNodeId id = stack.back();
+            stack.pop_back();
+
+            Node& node = m_nodes[id];
+            if (node.dirty)
+            {
+                TransformId transform = node.object->getTransformId();
+                node.local = batch ? transforms.getMatrix(transform) : transforms.computeMatrix(transform);
+                node.dirty = false;
+            }
+            node.world = node.parent != SCENE_NO_NODE ? m_nodes[node.parent].world * node.local : node.local;
+
+            if (!node.bounds.isEmpty())
+            {
+                BoundingBox worldBounds = node.bounds.transformed(node.world);
+                if (node.proxy == SPATIAL_NO_PROXY)
+                {
+                    node.proxy = m_index.insert(worldBounds, id);
+                }
+                else
+                {
+                    m_index.update(node.proxy, worldBounds);
+                }
+            }
+
+            for (SceneNodeId child = node.firstChild; child != SCENE_NO_NODE; child = m_nodes[child].nextSibling)
+            {
+                stack.push_back(child);
+            }
+        }
+    }
+}
+
+}
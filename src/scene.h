@@ -0,0 +1,131 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+
+#include "api.h"
+#include "boundingbox.h"
+#include "frustum.h"
+#include "matrix.h"
+#include "object.h"
+#include "spatialindex.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+using SceneNodeId = uint32;
+constexpr SceneNodeId SCENE_NO_NODE = UINT32_MAX;
+constexpr size_t SCENE_BATCH_MIN_DIRTY = 1024;		// Dirty nodes before update() converts every transform in one batch
+
+/// <summary>
+/// Hierarchy of objects (static meshes, cameras) with parent links. Each node caches its local
+/// matrix, built from its object's transform, and its world matrix, the parent's world matrix times
+/// the local one. Changing a node's transform only marks it dirty; update() then recomputes the
+/// dirty nodes and their descendants, and nothing else.
+/// </summary>
+class Scene
+{
+	struct Node
+	{
+		Object* object = nullptr;				// Not owned
+		SceneNodeId parent = SCENE_NO_NODE;
+		SceneNodeId firstChild = SCENE_NO_NODE;
+		SceneNodeId nextSibling = SCENE_NO_NODE;
+		Matrix4 local;
+		Matrix4 world;
+		bool dirty = true;						// The local matrix is out of date
+
+		// Nodes with bounds are kept in the spatial index, in world space
+		BoundingBox bounds;
+		SpatialProxyId proxy = SPATIAL_NO_PROXY;
+	};
+
+	std::vector<Node> m_nodes;
+	std::vector<SceneNodeId> m_dirty;			// Nodes marked since the last update, in any order
+	SpatialIndex m_index;
+
+	void link(SceneNodeId id, SceneNodeId parent);
+	void unlink(SceneNodeId id);
+
+public:
+	Scene() {};
+
+	Scene(const Scene&) = delete;
+	Scene& operator=(const Scene&) = delete;
+
+	size_t numNodes() const { return m_nodes.size(); }
+
+	/// <summary>
+	/// Adds a node for the given object under the given parent, or as a root. The scene does not
+	/// own the object; it must outlive the scene.
+	/// </summary>
+	/// <returns>The id of the new node, stable for the life of the scene.</returns>
+	SceneNodeId addNode(Object* object, SceneNodeId parent = SCENE_NO_NODE);
+
+	/// <summary>
+	/// Moves a node, with its descendants, under a new parent or to the root. Throws if the new
+	/// parent is the node itself or one of its descendants.
+	/// </summary>
+	void setParent(SceneNodeId id, SceneNodeId parent);
+
+	Object* getObject(SceneNodeId id) const { return m_nodes[id].object; }
+	SceneNodeId getParent(SceneNodeId id) const { return m_nodes[id].parent; }
+	SceneNodeId getFirstChild(SceneNodeId id) const { return m_nodes[id].firstChild; }
+	SceneNodeId getNextSibling(SceneNodeId id) const { return m_nodes[id].nextSibling; }
+
+	/// <summary>
+	/// Flags a node whose object's transform changed, so the next update() picks it up.
+	/// </summary>
+	void markDirty(SceneNodeId id)
+	{
+		if (!m_nodes[id].dirty)
+		{
+			m_nodes[id].dirty = true;
+			m_dirty.push_back(id);
+		}
+	}
+
+	/// <summary>
+	/// Sets the transform of a node's object, relative to its parent, and marks it dirty.
+	/// </summary>
+	void setTransform(SceneNodeId id, const Transform& transform)
+	{
+		m_nodes[id].object->setTransform(transform);
+		markDirty(id);
+	}
+
+	/// <summary>
+	/// Sets the object-space bounds of a node, which makes it visible to queryVisible(). Nodes
+	/// without bounds, such as cameras, are never returned by queries.
+	/// </summary>
+	void setBounds(SceneNodeId id, const BoundingBox& bounds);
+
+	/// <summary>
+	/// Recomputes the cached matrices of every dirty node and of everything below them, and moves
+	/// their bounds in the spatial index. The cost is proportional to the size of the moved
+	/// subtrees, not of the scene.
+	/// </summary>
+	void update();
+
+	/// <summary>
+	/// Appends every node whose bounds may be inside the frustum, as of the last update().
+	/// </summary>
+	void queryVisible(const Frustum& frustum, std::vector<SceneNodeId>& visible) const
+	{
+		m_index.query(frustum, [&](uint32 id) { visible.push_back(id); });
+	}
+
+	/// <summary>
+	/// Returns the number of nodes with bounds.
+	/// </summary>
+	size_t numBoundedNodes() const { return m_index.size(); }
+
+	/// <summary>
+	/// Returns the cached world matrix of a node, as of the last update().
+	/// </summary>
+	const Matrix4& getWorldMatrix(SceneNodeId id) const { return m_nodes[id].world; }
+};
+
+}
+
+#endif
@@ -10,6 +10,15 @@ using namespace Graphics;
 #define BLINN_MODEL false
 #define BLINN_PHONG_MODEL true
 
+/// <summary>
+/// Where lighting is evaluated when drawing a triangle.
+/// </summary>
+enum class ShadingMode
+{
+	Flat,		// Per pixel, with the face normal
+	Gouraud		// Per vertex, with the vertex normal; colors are interpolated across the triangle
+};
+
 /// <summary>
 /// Base class for all shaders.
 /// </summary>
@@ -32,6 +41,7 @@ public:
 	Vector3 viewNormal;
 	Vector3 pixelPosition;
 	Vector3 uvw;
+	bool inShadow = false;
 };
 
 /// <summary>
@@ -41,6 +51,8 @@ class StandardShader
 	: public IShader
 {
 public:
+	Vector3 lightPosition = Vector3(25.0, 25.0, 0.0);
+
 	void vertex(Vector3* v)
 	{
 		// Convert to normalized device coords
@@ -55,26 +67,39 @@ public:
 	}
 
 	Vector3 fragment()
+	{
+		return shade(worldPosition, worldNormal, inShadow);
+	}
+
+	/// <summary>
+	/// Evaluates the lighting at the given world-space position and normal, as seen from viewPosition.
+	/// Points in shadow only receive ambient light.
+	/// </summary>
+	Vector3 shade(const Vector3& position, const Vector3& normal, bool shadowed = false)
 	{
 		Vector3 ambient(0.1);
 		Vector3 color(0.5, 0.25, 0.5);
-		Vector3 lightPosition(25.0, 25.0, 0.0);
 		Vector3 lightColor(1.0, 0.5, 0.25);
 		double shininess = 16.0;
 		double lightIntensity = 1.0;
 		Vector3 specularColor(1.0, 1.0, 1.0);
 
+		if (shadowed)
+		{
+			return ambient;
+		}
+
 		// Calculate normalized view direction
-		Vector3 viewDirection = normalize(viewPosition - worldPosition);
+		Vector3 viewDirection = normalize(viewPosition - position);
 
 		// Calculate normalized light direction to pixel position
-		Vector3 lightDirection = normalize(lightPosition - worldPosition);
+		Vector3 lightDirection = normalize(lightPosition - position);
 
 		// Inverse falloff distance
 		double distance = pow(lightDirection.length(), 2.0);
 
 		// Calculate lighting contribution
-		double lighting = MAX(dot(lightDirection, worldNormal), 0.0);
+		double lighting = MAX(dot(lightDirection, normal), 0.0);
 		double specular = 0.0;
 
 		// If lighting contribution is greater than 0, we can calculate specular contribution
@@ -84,7 +109,7 @@ public:
 			Vector3 halfDirection = normalize(lightDirection + viewDirection);
 
 			// Calculate specular contribution
-			double specularAngle = MAX(dot(halfDirection, worldNormal), 0.0);
+			double specularAngle = MAX(dot(halfDirection, normal), 0.0);
 			specular = pow(specularAngle, shininess);
 		}
 
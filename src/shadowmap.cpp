@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "parallel.h"
+#include "shadowmap.h"
+#include "trianglesetup.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+void ShadowMap::clear()
+{
+    m_depth.clear();
+    m_generation = 0;
+    m_models.clear();
+}
+
+bool ShadowMap::update(const Vector3& lightPosition, const MeshView& mesh, std::span<const Matrix4> models)
+{
+    // Nothing that can cast a shadow has changed since the last draw
+    if (!m_depth.empty() && lightPosition == m_lightPosition && mesh.generation == m_generation &&
+        std::equal(models.begin(), models.end(), m_models.begin(), m_models.end()))
+    {
+        return false;
+    }
+
+    clear();
+    if (mesh.numTriangles() == 0 || models.empty())
+    {
+        return true;
+    }
+    m_lightPosition = lightPosition;
+    m_generation = mesh.generation;
+    m_models.assign(models.begin(), models.end());
+
+    // Look from the light at the sphere around every instance, wide enough to take it all in
+    BoundingBox bounds;
+    for (const Matrix4& model : models)
+    {
+        bounds.expand(mesh.bounds.transformed(model));
+    }
+    Vector3 forward = bounds.getCenter() - lightPosition;
+    double distance = forward.length();
+    double radius = bounds.getSize().length() * 0.5;
+    forward = distance > 0.0 ? forward * (1.0 / distance) : Vector3(0.0, -1.0, 0.0);
+    double tanHalf = distance > radius ? radius / std::sqrt(distance * distance - radius * radius) : SHADOW_MAP_MAX_TAN;
+    tanHalf = std::min(tanHalf, SHADOW_MAP_MAX_TAN);
+
+    Vector3 up = std::abs(forward._y) < 0.99 ? Vector3::up() : Vector3(1.0, 0.0, 0.0);
+    Vector3 right = normalize(cross(up, forward));
+    up = cross(forward, right);
+    const Vector3* axes[3] = { &right, &up, &forward };
+    m_lightView = Matrix4();
+    for (int row = 0; row < 3; row++)
+    {
+        m_lightView[row][0] = axes[row]->_x;
+        m_lightView[row][1] = axes[row]->_y;
+        m_lightView[row][2] = axes[row]->_z;
+        m_lightView[row][3] = -dot(*axes[row], lightPosition);
+    }
+    m_scale = SHADOW_MAP_SIZE * 0.5 / tanHalf;
+    m_texelSize = 1.0 / m_scale;
+
+    m_depth.assign((size_t) SHADOW_MAP_SIZE * SHADOW_MAP_SIZE, FLT_MAX);
+    m_projected.resize(mesh.numVertices());
+    for (const Matrix4& model : models)
+    {
+        Matrix4 m = m_lightView * model;
+        parallelFor(mesh.numVertices(), MESH_PARALLEL_BATCH_SIZE, [&](size_t first, size_t last)
+        {
+            for (size_t v = first; v < last; v++)
+            {
+                Vector4 p = m * Vector4(mesh.getPosition((uint32) v), 1.0);
+                if (p._z > SHADOW_MAP_MIN_DEPTH)
+                {
+                    double inverseDepth = 1.0 / p._z;
+                    m_projected[v] = Vector3(p._x * inverseDepth * m_scale + SHADOW_MAP_SIZE * 0.5,
+                                             p._y * inverseDepth * m_scale + SHADOW_MAP_SIZE * 0.5, inverseDepth);
+                }
+                else
+                {
+                    m_projected[v] = Vector3(0.0);
+                }
+            }
+        });
+
+        for (size_t i = 0; i < mesh.numTriangles(); i++)
+        {
+            const Vector3& v1 = m_projected[mesh.indices[i * 3]];
+            const Vector3& v2 = m_projected[mesh.indices[i * 3 + 1]];
+            const Vector3& v3 = m_projected[mesh.indices[i * 3 + 2]];
+            if (v1._z > 0.0 && v2._z > 0.0 && v3._z > 0.0)
+            {
+                drawTriangle(v1, v2, v3);
+            }
+        }
+    }
+
+    return true;
+}
+
+void ShadowMap::drawTriangle(const Vector3& v1, const Vector3& v2, const Vector3& v3)
+{
+    TriangleSetup t;
+    if (!setupTriangle(v1, v2, v3, t))
+    {
+        return;
+    }
+
+    // Pixels whose centers may lie inside the triangle
+    int x0 = (int) std::max(std::ceil(t.minX - 0.5), 0.0);
+    int y0 = (int) std::max(std::ceil(t.minY - 0.5), 0.0);
+    int x1 = (int) std::min(std::floor(t.maxX - 0.5), SHADOW_MAP_SIZE - 1.0);
+    int y1 = (int) std::min(std::floor(t.maxY - 0.5), SHADOW_MAP_SIZE - 1.0);
+    if (x0 > x1 || y0 > y1)
+    {
+        return;
+    }
+
+    // Step every function along each row rather than evaluating it per pixel
+    double left = x0 + 0.5;
+    for (int y = y0; y <= y1; y++)
+    {
+        double center = y + 0.5;
+        double e0 = t.edgeA[0] * left + t.edgeB[0] * center + t.edgeC[0];
+        double e1 = t.edgeA[1] * left + t.edgeB[1] * center + t.edgeC[1];
+        double e2 = t.edgeA[2] * left + t.edgeB[2] * center + t.edgeC[2];
+        double inverseDepth = t.getInverseDepth(left, center);
+        float* row = &m_depth[(size_t) y * SHADOW_MAP_SIZE];
+        for (int x = x0; x <= x1; x++)
+        {
+            if (e0 >= 0.0 && e1 >= 0.0 && e2 >= 0.0 && inverseDepth > 0.0)
+            {
+                row[x] = std::min(row[x], (float) (1.0 / inverseDepth));
+            }
+            e0 += t.edgeA[0];
+            e1 += t.edgeA[1];
+            e2 += t.edgeA[2];
+            inverseDepth += t.depthA;
+        }
+    }
+}
+
+bool ShadowMap::isShadowed(const Vector3& position, const Vector3& normal) const
+{
+    if (m_depth.empty() || dot(normal, m_lightPosition - position) <= 0.0)
+    {
+        return false;
+    }
+
+    // Pixels cover more of the world further from the light, and so do the offsets
+    Vector4 p = m_lightView * Vector4(position, 1.0);
+    double texel = p._z * m_texelSize;
+    p = m_lightView * Vector4(position + normal * (texel * SHADOW_MAP_NORMAL_OFFSET), 1.0);
+    if (p._z <= SHADOW_MAP_MIN_DEPTH)
+    {
+        return false;
+    }
+
+    double x = std::floor(p._x / p._z * m_scale + SHADOW_MAP_SIZE * 0.5);
+    double y = std::floor(p._y / p._z * m_scale + SHADOW_MAP_SIZE * 0.5);
+    if (x < 0.0 || y < 0.0 || x >= SHADOW_MAP_SIZE || y >= SHADOW_MAP_SIZE)
+    {
+        return false;
+    }
+
+    return getDepth((int) x, (int) y) < p._z - texel * SHADOW_MAP_DEPTH_BIAS;
+}
+
+}
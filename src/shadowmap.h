@@ -0,0 +1,71 @@
+#ifndef SHADOWMAP_H
+#define SHADOWMAP_H
+
+#include <span>
+#include <vector>
+
+#include "api.h"
+#include "boundingbox.h"
+#include "matrix.h"
+#include "mesh.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+constexpr int SHADOW_MAP_SIZE = 1024;				// Pixels per side
+constexpr double SHADOW_MAP_MAX_TAN = 4.0;			// Widest half angle covered, as its tangent (about 76 degrees)
+constexpr double SHADOW_MAP_NORMAL_OFFSET = 1.5;	// Lookups move off the surface by this many pixels' width
+constexpr double SHADOW_MAP_DEPTH_BIAS = 1.0;		// And compare against depths this many pixels' width nearer
+constexpr double SHADOW_MAP_MIN_DEPTH = 1e-6;		// Closer than this to the light, geometry is skipped
+
+/// <summary>
+/// Depth of the nearest geometry as seen from a point light, for shadow lookups. The map looks
+/// from the light at the bounds of everything drawn into it and is only redrawn when the light,
+/// the mesh or any of the model matrices change. Drawing is depth only: vertices are projected
+/// once, and each pixel of a triangle only steps its edge functions and inverse depth.
+/// </summary>
+class ShadowMap
+{
+	Vector3 m_lightPosition;
+	Matrix4 m_lightView;						// World to light space, with +z away from the light
+	double m_scale = 0.0;						// Light space x / z to map pixels
+	double m_texelSize = 0.0;					// World size of one pixel, one unit from the light
+
+	std::vector<float> m_depth;
+	std::vector<Vector3> m_projected;			// Map x, y and inverse depth of the mesh being drawn
+
+	// What the map was last drawn from
+	uint64 m_generation = 0;					// See Mesh::getGeneration()
+	std::vector<Matrix4> m_models;
+
+	void drawTriangle(const Vector3& v1, const Vector3& v2, const Vector3& v3);
+
+public:
+	ShadowMap() {};
+
+	bool empty() const { return m_depth.empty(); }
+
+	/// <summary>
+	/// Returns the light-space depth of the nearest geometry at the given map pixel.
+	/// </summary>
+	float getDepth(int x, int y) const { return m_depth[(size_t) y * SHADOW_MAP_SIZE + x]; }
+
+	/// <summary>
+	/// Redraws the map with every instance of the mesh, unless it already holds exactly that.
+	/// </summary>
+	/// <param name="models">The model matrix of each instance.</param>
+	/// <returns>Whether the map was redrawn.</returns>
+	bool update(const Vector3& lightPosition, const MeshView& mesh, std::span<const Matrix4> models);
+
+	void clear();
+
+	/// <summary>
+	/// Returns whether something in the map is nearer the light than the given surface point.
+	/// Surfaces facing away from the light, and points outside the map, are never shadowed.
+	/// </summary>
+	bool isShadowed(const Vector3& position, const Vector3& normal) const;
+};
+
+}
+
+#endif
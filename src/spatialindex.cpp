@@ -0,0 +1,173 @@
+#include "spatialindex.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+static BoundingBox merge(const BoundingBox& a, const BoundingBox& b)
+{
+    BoundingBox result = a;
+    result.expand(b);
+    return result;
+}
+
+uint32 SpatialIndex::allocateNode()
+{
+    if (!m_free.empty())
+    {
+        uint32 node = m_free.back();
+        m_free.pop_back();
+        m_nodes[node] = Node();
+        return node;
+    }
+
+    m_nodes.emplace_back();
+    return (uint32) m_nodes.size() - 1;
+}
+
+void SpatialIndex::freeNode(uint32 node)
+{
+    m_free.push_back(node);
+}
+
+SpatialProxyId SpatialIndex::insert(const BoundingBox& bounds, uint32 userData)
+{
+    Vector3 margin = bounds.getSize() * SPATIAL_INDEX_MARGIN;
+
+    uint32 leaf = allocateNode();
+    m_nodes[leaf].bounds = BoundingBox(bounds.getMin() - margin, bounds.getMax() + margin);
+    m_nodes[leaf].userData = userData;
+    insertLeaf(leaf);
+    m_count++;
+    return leaf;
+}
+
+void SpatialIndex::remove(SpatialProxyId proxy)
+{
+    removeLeaf(proxy);
+    freeNode(proxy);
+    m_count--;
+}
+
+bool SpatialIndex::update(SpatialProxyId proxy, const BoundingBox& bounds)
+{
+    if (m_nodes[proxy].bounds.contains(bounds))
+    {
+        return false;
+    }
+
+    Vector3 margin = bounds.getSize() * SPATIAL_INDEX_MARGIN;
+    removeLeaf(proxy);
+    m_nodes[proxy].bounds = BoundingBox(bounds.getMin() - margin, bounds.getMax() + margin);
+    insertLeaf(proxy);
+    return true;
+}
+
+void SpatialIndex::insertLeaf(uint32 leaf)
+{
+    if (m_root == SPATIAL_NO_PROXY)
+    {
+        m_root = leaf;
+        m_nodes[leaf].parent = SPATIAL_NO_PROXY;
+        return;
+    }
+
+    // Walk down to the sibling that makes the new parent cheapest. Every node on the way grows to
+    // hold the leaf, which is the inherited cost of going further down.
+    const BoundingBox& leafBounds = m_nodes[leaf].bounds;
+    uint32 sibling = m_root;
+    while (!m_nodes[sibling].isLeaf())
+    {
+        const Node& node = m_nodes[sibling];
+        double area = node.bounds.getSurfaceArea();
+        double combinedArea = merge(node.bounds, leafBounds).getSurfaceArea();
+
+        // Pairing with this node: a new parent around both
+        double cost = 2.0 * combinedArea;
+        double inheritedCost = 2.0 * (combinedArea - area);
+
+        auto descendCost = [&](uint32 child)
+        {
+            const BoundingBox& childBounds = m_nodes[child].bounds;
+            double grown = merge(childBounds, leafBounds).getSurfaceArea();
+            return m_nodes[child].isLeaf() ? grown + inheritedCost
+                                           : grown - childBounds.getSurfaceArea() + inheritedCost;
+        };
+        double leftCost = descendCost(node.left);
+        double rightCost = descendCost(node.right);
+
+        if (cost < leftCost && cost < rightCost)
+        {
+            break;
+        }
+        sibling = leftCost < rightCost ? node.left : node.right;
+    }
+
+    // Put a new parent above the sibling, holding it and the leaf
+    uint32 oldParent = m_nodes[sibling].parent;
+    uint32 newParent = allocateNode();
+    m_nodes[newParent].parent = oldParent;
+    m_nodes[newParent].left = sibling;
+    m_nodes[newParent].right = leaf;
+    m_nodes[sibling].parent = newParent;
+    m_nodes[leaf].parent = newParent;
+
+    if (oldParent == SPATIAL_NO_PROXY)
+    {
+        m_root = newParent;
+    }
+    else if (m_nodes[oldParent].left == sibling)
+    {
+        m_nodes[oldParent].left = newParent;
+    }
+    else
+    {
+        m_nodes[oldParent].right = newParent;
+    }
+
+    refit(newParent);
+}
+
+void SpatialIndex::removeLeaf(uint32 leaf)
+{
+    if (leaf == m_root)
+    {
+        m_root = SPATIAL_NO_PROXY;
+        return;
+    }
+
+    // The leaf's sibling takes its parent's place
+    uint32 parent = m_nodes[leaf].parent;
+    uint32 grandParent = m_nodes[parent].parent;
+    uint32 sibling = m_nodes[parent].left == leaf ? m_nodes[parent].right : m_nodes[parent].left;
+
+    m_nodes[sibling].parent = grandParent;
+    if (grandParent == SPATIAL_NO_PROXY)
+    {
+        m_root = sibling;
+    }
+    else
+    {
+        if (m_nodes[grandParent].left == parent)
+        {
+            m_nodes[grandParent].left = sibling;
+        }
+        else
+        {
+            m_nodes[grandParent].right = sibling;
+        }
+        refit(grandParent);
+    }
+
+    freeNode(parent);
+    m_nodes[leaf].parent = SPATIAL_NO_PROXY;
+}
+
+void SpatialIndex::refit(uint32 node)
+{
+    for (; node != SPATIAL_NO_PROXY; node = m_nodes[node].parent)
+    {
+        m_nodes[node].bounds = merge(m_nodes[m_nodes[node].left].bounds, m_nodes[m_nodes[node].right].bounds);
+    }
+}
+
+}
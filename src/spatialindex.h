@@ -0,0 +1,108 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <vector>
+
+#include "api.h"
+#include "boundingbox.h"
+#include "frustum.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+using SpatialProxyId = uint32;
+constexpr SpatialProxyId SPATIAL_NO_PROXY = UINT32_MAX;
+
+constexpr double SPATIAL_INDEX_MARGIN = 0.1;	// Fraction of a box's size it is loosened by on every side
+
+/// <summary>
+/// Bounding volume hierarchy over object bounds, built incrementally. Each object is a leaf
+/// holding a loosened copy of its bounds, so small moves don't touch the tree at all; an object
+/// that leaves its loose box is removed and reinserted, and the boxes of its old and new ancestors
+/// are refit. Leaves are placed where they grow the tree's surface area the least.
+/// </summary>
+class SpatialIndex
+{
+	struct Node
+	{
+		BoundingBox bounds;
+		uint32 parent = SPATIAL_NO_PROXY;
+		uint32 left = SPATIAL_NO_PROXY;			// Both children are SPATIAL_NO_PROXY for leaves
+		uint32 right = SPATIAL_NO_PROXY;
+		uint32 userData = 0;
+
+		bool isLeaf() const { return left == SPATIAL_NO_PROXY; }
+	};
+
+	std::vector<Node> m_nodes;
+	std::vector<uint32> m_free;
+	uint32 m_root = SPATIAL_NO_PROXY;
+	size_t m_count = 0;
+
+	uint32 allocateNode();
+	void freeNode(uint32 node);
+	void insertLeaf(uint32 leaf);
+	void removeLeaf(uint32 leaf);
+	void refit(uint32 node);
+
+public:
+	SpatialIndex() {};
+
+	/// <summary>
+	/// Returns the number of objects in the index.
+	/// </summary>
+	size_t size() const { return m_count; }
+
+	/// <summary>
+	/// Adds an object with the given bounds and returns its proxy.
+	/// </summary>
+	/// <param name="userData">Passed back to query callbacks.</param>
+	SpatialProxyId insert(const BoundingBox& bounds, uint32 userData);
+
+	void remove(SpatialProxyId proxy);
+
+	/// <summary>
+	/// Updates an object's bounds. The tree only changes if the new bounds are outside the loose
+	/// box the object was last inserted with.
+	/// </summary>
+	/// <returns>Whether the object was reinserted.</returns>
+	bool update(SpatialProxyId proxy, const BoundingBox& bounds);
+
+	/// <summary>
+	/// Calls func(userData) for every object whose loose bounds may be inside the frustum. Whole
+	/// subtrees outside it are skipped.
+	/// </summary>
+	template<typename Func>
+	void query(const Frustum& frustum, Func&& func) const
+	{
+		if (m_root == SPATIAL_NO_PROXY)
+		{
+			return;
+		}
+
+		std::vector<uint32> stack = { m_root };
+		while (!stack.empty())
+		{
+			const Node& node = m_nodes[stack.back()];
+			stack.pop_back();
+			if (!frustum.intersectsBox(node.bounds))
+			{
+				continue;
+			}
+
+			if (node.isLeaf())
+			{
+				func(node.userData);
+			}
+			else
+			{
+				stack.push_back(node.left);
+				stack.push_back(node.right);
+			}
+		}
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,222 @@
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "meshsimplifier.h"
+#include "staticmesh.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+/// <summary>
+/// Joins level builds whose mesh was replaced. Meshes are replaced on the render thread, which
+/// must not wait for a build to notice it was cancelled, so the waiting happens here instead.
+/// </summary>
+class LodReaper
+{
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<std::thread> m_threads;
+    bool m_stopping = false;
+    std::thread m_thread;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wake.wait(lock, [this] { return m_stopping || !m_threads.empty(); });
+            if (m_threads.empty())
+            {
+                return;
+            }
+
+            std::vector<std::thread> threads = std::move(m_threads);
+            m_threads.clear();
+            lock.unlock();
+            for (std::thread& thread : threads)
+            {
+                thread.join();
+            }
+            lock.lock();
+        }
+    }
+
+public:
+    LodReaper() : m_thread(&LodReaper::run, this) { };
+
+    ~LodReaper()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    void add(std::thread&& thread)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_threads.push_back(std::move(thread));
+        }
+        m_wake.notify_one();
+    }
+};
+
+static LodReaper& getLodReaper()
+{
+    static LodReaper reaper;
+    return reaper;
+}
+
+LodChain::~LodChain()
+{
+    for (size_t level = 0; level < count; level++)
+    {
+        delete lods[level].mesh;
+    }
+}
+
+StaticMesh::~StaticMesh()
+{
+    clear();
+}
+
+void StaticMesh::clear()
+{
+    if (m_lods != nullptr)
+    {
+        m_lods->cancel = true;
+    }
+    if (m_lodThread.joinable())
+    {
+        getLodReaper().add(std::move(m_lodThread));
+    }
+    m_lods.reset();
+}
+
+void StaticMesh::setMesh(Mesh* mesh)
+{
+    clear();
+
+    m_lods = std::make_shared<LodChain>();
+    m_lods->lods[0].mesh = mesh;
+    m_lods->count.store(1, std::memory_order_release);
+
+    if (mesh->numTriangles() >= LOD_MIN_TRIANGLES * 2)
+    {
+        m_lodThread = std::thread(&StaticMesh::buildLods, m_lods);
+    }
+}
+
+void StaticMesh::buildLods(std::shared_ptr<LodChain> chain)
+{
+    // Levels get a BVH when the full mesh has one, so they can be ray traced as well
+    bool buildBvh = !chain->lods[0].mesh->getBvh().empty();
+
+    // Each level is simplified from the previous one, so their errors add up
+    for (size_t level = 1; level < LOD_MAX_LEVELS; level++)
+    {
+        const MeshLod& previous = chain->lods[level - 1];
+        size_t target = previous.mesh->numTriangles() / 2;
+        if (target < LOD_MIN_TRIANGLES)
+        {
+            return;
+        }
+
+        double error = 0.0;
+        Mesh* mesh = simplifyMesh(previous.mesh, target, error, &chain->cancel);
+        if (mesh == nullptr)
+        {
+            return;
+        }
+
+        // Give up once the simplifier can't make meaningful progress
+        if (mesh->numTriangles() > previous.mesh->numTriangles() * LOD_MIN_REDUCTION)
+        {
+            delete mesh;
+            return;
+        }
+
+        if (buildBvh)
+        {
+            mesh->computeBvh();
+        }
+
+        chain->lods[level].mesh = mesh;
+        chain->lods[level].error = previous.error + error;
+        chain->count.store(level + 1, std::memory_order_release);
+
+        if (chain->cancel)
+        {
+            return;
+        }
+    }
+}
+
+size_t StaticMesh::selectLod(Camera* camera, int viewportWidth, int viewportHeight, const Matrix4& world,
+                             std::span<const Matrix4> instances, double pixelError)
+{
+    size_t count = getLodCount();
+    const BoundingBox& bounds = getMesh()->getBounds();
+    if (count <= 1 || bounds.isEmpty())
+    {
+        return 0;
+    }
+
+    Vector3 center = bounds.getCenter();
+    Vector3 position = camera->getTranslation();
+    double radius = bounds.getSize().length() * 0.5;
+    Frustum frustum = camera->getFrustum(viewportWidth, viewportHeight);
+
+    // World units per object unit over the distance to the nearest point of the bounding sphere,
+    // for the instance in view where that is largest
+    double scalePerDepth = 0.0;
+    size_t instanceCount = std::max(instances.size(), (size_t) 1);
+    for (size_t i = 0; i < instanceCount; i++)
+    {
+        Matrix4 model = instances.empty() ? world : world * instances[i];
+
+        // Scale the sphere to world space by the model's largest axis scale
+        double scale = 0.0;
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            scale = std::max(scale, Vector3(model[0][axis], model[1][axis], model[2][axis]).length());
+        }
+        Vector4 worldCenter = model * Vector4(center, 1.0);
+        Vector3 sphereCenter(worldCenter._x, worldCenter._y, worldCenter._z);
+        double sphereRadius = radius * scale;
+        if (!frustum.intersectsSphere(sphereCenter, sphereRadius))
+        {
+            continue;
+        }
+
+        // Inside the sphere everything is full detail
+        double depth = distance(position, sphereCenter) - sphereRadius;
+        if (depth <= 0.0)
+        {
+            return 0;
+        }
+        scalePerDepth = std::max(scalePerDepth, scale / depth);
+    }
+
+    // Nothing in view, nothing to see the difference
+    if (scalePerDepth == 0.0)
+    {
+        return count - 1;
+    }
+
+    // Pixels covered by one object-space unit, from the vertical field of view
+    double pixelsPerUnit = viewportHeight * scalePerDepth / (2.0 * tan(RADIANS(camera->getFieldOfView()) * 0.5));
+
+    size_t level = 0;
+    while (level + 1 < count && m_lods->lods[level + 1].error * pixelsPerUnit <= pixelError)
+    {
+        level++;
+    }
+    return level;
+}
+
+}
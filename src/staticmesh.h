@@ -1,29 +1,104 @@
 #ifndef STATICMESH_H
 #define STATICMESH_H
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <span>
+#include <thread>
+
 #include "api.h"
+#include "camera.h"
 #include "mesh.h"
 #include "object.h"
 
 namespace Graphics {
 using namespace Graphics;
 
+constexpr size_t LOD_MAX_LEVELS = 8;
+constexpr size_t LOD_MIN_TRIANGLES = 64;		// No level is built below this many triangles
+constexpr double LOD_MIN_REDUCTION = 0.8;		// A level must have at most this fraction of the previous one's triangles
+constexpr double LOD_PIXEL_ERROR = 1.0;			// Largest on-screen error, in pixels, a level may be drawn with
+
+/// <summary>
+/// One level of detail of a mesh, along with how far it strays from the full mesh in object space.
+/// </summary>
+struct MeshLod
+{
+	Mesh* mesh = nullptr;
+	double error = 0.0;
+};
+
+/// <summary>
+/// The levels of detail of one mesh, shared with the thread that builds them. Once the mesh is
+/// replaced the build is cancelled and left to wind down on its own, and whichever side lets go
+/// last deletes the levels, the full mesh included.
+/// </summary>
+struct LodChain
+{
+	// Level 0 is the full mesh. Levels are only appended by the build thread, count is
+	// published after each one is complete.
+	std::array<MeshLod, LOD_MAX_LEVELS> lods;
+	std::atomic<size_t> count = 0;
+	std::atomic<bool> cancel = false;
+
+	LodChain() { };
+	~LodChain();
+
+	LodChain(const LodChain&) = delete;
+	LodChain& operator=(const LodChain&) = delete;
+};
+
 /// <summary>
 /// Encapsulation class of raw mesh data so we can control one object's transformation while preserving
-/// the original mesh's vertex positions.
+/// the original mesh's vertex positions. Owns its mesh and builds a chain of simplified levels of
+/// detail for it in the background, each about half the triangles of the one before.
 /// </summary>
 class StaticMesh :
-	Object
+	public Object
 {
-	Mesh* m_mesh = new Mesh();
+	std::shared_ptr<LodChain> m_lods;
+	std::thread m_lodThread;
+
+	static void buildLods(std::shared_ptr<LodChain> chain);
+	void clear();
 
 public:
-	StaticMesh() { };
-	StaticMesh(Mesh* mesh) :
-		m_mesh(mesh) { };
+	StaticMesh() : StaticMesh(new Mesh()) { };
+	StaticMesh(Mesh* mesh) { setMesh(mesh); };
+	~StaticMesh();
+
+	StaticMesh(const StaticMesh&) = delete;
+	StaticMesh& operator=(const StaticMesh&) = delete;
+
+	Mesh* getMesh() { return m_lods->lods[0].mesh; }
+
+	/// <summary>
+	/// Replaces the mesh, taking ownership of it, and starts building a new level chain. The
+	/// previous mesh and its levels are deleted once their cancelled build has stopped, which
+	/// the caller does not wait for.
+	/// </summary>
+	void setMesh(Mesh* mesh);
+
+	/// <summary>
+	/// Returns the number of levels built so far, including the full mesh.
+	/// </summary>
+	size_t getLodCount() { return m_lods->count.load(std::memory_order_acquire); }
+	const MeshLod& getLod(size_t level) { return m_lods->lods[level]; }
 
-	Mesh* getMesh() { return m_mesh; }
-	void setMesh(Mesh* mesh) { m_mesh = mesh; }
+	/// <summary>
+	/// Returns the coarsest level whose error stays under the given number of pixels on every
+	/// instance in view. The instance nearest the camera for its scale decides; with the camera
+	/// inside any instance's bounding sphere, that is the full mesh.
+	/// </summary>
+	/// <param name="camera">The camera the mesh is viewed through.</param>
+	/// <param name="viewportWidth">The width of the viewport, in pixels.</param>
+	/// <param name="viewportHeight">The height of the viewport, in pixels.</param>
+	/// <param name="world">The mesh's world matrix.</param>
+	/// <param name="instances">Optional. The transforms the mesh is drawn with, each combined with
+	/// the world matrix as Framebuffer::bindInstances() does. Without any, the mesh is drawn once.</param>
+	size_t selectLod(Camera* camera, int viewportWidth, int viewportHeight, const Matrix4& world,
+					 std::span<const Matrix4> instances = {}, double pixelError = LOD_PIXEL_ERROR);
 };
 
 }
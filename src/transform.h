@@ -42,7 +42,7 @@ namespace Graphics
      private:
         Vector3 m_translation;
         Rotation m_rotation;
-        Vector3 m_scale;
+        Vector3 m_scale = Vector3(1.0);
     };
 
 }
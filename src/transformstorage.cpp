@@ -0,0 +1,134 @@
+#include <algorithm>
+
+#include "transformstorage.h"
+#include "parallel.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+TransformStorage& TransformStorage::get()
+{
+    static TransformStorage storage;
+    return storage;
+}
+
+TransformId TransformStorage::create()
+{
+    TransformId id;
+    if (!m_free.empty())
+    {
+        id = m_free.back();
+        m_free.pop_back();
+    }
+    else
+    {
+        id = (TransformId) size();
+        for (auto* component : { &m_translationX, &m_translationY, &m_translationZ, &m_rotationR, &m_rotationX,
+                                 &m_rotationY, &m_rotationZ, &m_scaleX, &m_scaleY, &m_scaleZ })
+        {
+            component->push_back(0.0);
+        }
+    }
+
+    setTranslation(id, Vector3(0.0));
+    setRotation(id, Rotation().setIdentity());
+    setScale(id, Vector3(1.0));
+    return id;
+}
+
+void TransformStorage::destroy(TransformId id)
+{
+    m_free.push_back(id);
+}
+
+Rotation TransformStorage::getRotation(TransformId id) const
+{
+    double s = sqrt(1.0 - std::min(m_rotationR[id] * m_rotationR[id], 1.0));
+    if (s < EPSILON)
+    {
+        return Rotation().setIdentity();
+    }
+
+    double angle = 2.0 * acos(std::clamp(m_rotationR[id], -1.0, 1.0)) * 180.0 / PI;
+    return Rotation(Vector3(m_rotationX[id] / s, m_rotationY[id] / s, m_rotationZ[id] / s), angle);
+}
+
+void TransformStorage::setRotation(TransformId id, const Rotation& r)
+{
+    Rotation rotation = r;
+    Vector3 axis = rotation.getAxis();
+    double halfAngle = RADIANS(rotation.getAngle()) * 0.5;
+    double w = cos(halfAngle);
+    double x = axis._x * sin(halfAngle);
+    double y = axis._y * sin(halfAngle);
+    double z = axis._z * sin(halfAngle);
+    double length = sqrt(w * w + x * x + y * y + z * z);
+
+    // Rotations without a usable axis, such as Rotation::identity(), don't rotate
+    if (!(length > EPSILON))
+    {
+        w = 1.0;
+        x = y = z = 0.0;
+        length = 1.0;
+    }
+
+    m_rotationR[id] = w / length;
+    m_rotationX[id] = x / length;
+    m_rotationY[id] = y / length;
+    m_rotationZ[id] = z / length;
+}
+
+void TransformStorage::computeMatrices(size_t first, size_t last, Matrix4* out) const
+{
+    for (size_t i = first; i < last; i++)
+    {
+        double r = m_rotationR[i];
+        double x = m_rotationX[i];
+        double y = m_rotationY[i];
+        double z = m_rotationZ[i];
+
+        double sx = m_scaleX[i];
+        double sy = m_scaleY[i];
+        double sz = m_scaleZ[i];
+
+        // Same rotation layout as Matrix4::setRotation, with each column scaled
+        Matrix4& m = out[i - first];
+        m[0][0] = (1.0 - 2.0 * (y * y + z * z)) * sx;
+        m[0][1] = (2.0 * (x * y + z * r)) * sy;
+        m[0][2] = (2.0 * (z * x - y * r)) * sz;
+        m[0][3] = m_translationX[i];
+
+        m[1][0] = (2.0 * (x * y - z * r)) * sx;
+        m[1][1] = (1.0 - 2.0 * (z * z + x * x)) * sy;
+        m[1][2] = (2.0 * (y * z + x * r)) * sz;
+        m[1][3] = m_translationY[i];
+
+        m[2][0] = (2.0 * (z * x + y * r)) * sx;
+        m[2][1] = (2.0 * (y * z - x * r)) * sy;
+        m[2][2] = (1.0 - 2.0 * (y * y + x * x)) * sz;
+        m[2][3] = m_translationZ[i];
+
+        m[3][0] = 0.0;
+        m[3][1] = 0.0;
+        m[3][2] = 0.0;
+        m[3][3] = 1.0;
+    }
+}
+
+Matrix4 TransformStorage::computeMatrix(TransformId id) const
+{
+    Matrix4 m;
+    computeMatrices(id, (size_t) id + 1, &m);
+    return m;
+}
+
+void TransformStorage::updateMatrices()
+{
+    m_matrices.resize(size());
+    parallelFor(size(), TRANSFORM_PARALLEL_BATCH_SIZE, [this](size_t first, size_t last)
+    {
+        computeMatrices(first, last, &m_matrices[first]);
+    });
+}
+
+}
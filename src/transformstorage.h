@@ -0,0 +1,102 @@
+#ifndef TRANSFORMSTORAGE_H
+#define TRANSFORMSTORAGE_H
+
+#include <vector>
+
+#include "api.h"
+#include "matrix.h"
+#include "rotation.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+using TransformId = uint32;
+
+constexpr size_t TRANSFORM_PARALLEL_BATCH_SIZE = 1 << 12;	// Smallest batch of transforms worth a thread
+
+/// <summary>
+/// Every object's translation, rotation and scale, stored as one contiguous array per component
+/// rather than one struct per object. Objects hold a TransformId into it. updateMatrices() turns
+/// all of them into matrices in one pass that streams through the arrays in order.
+///
+/// There is a single storage shared by all objects. It is not synchronized; create, modify and
+/// destroy transforms from the main thread only.
+/// </summary>
+class TransformStorage
+{
+	// Components, indexed by TransformId
+	std::vector<double> m_translationX, m_translationY, m_translationZ;
+	std::vector<double> m_rotationR, m_rotationX, m_rotationY, m_rotationZ;	// Rotation as a unit quaternion
+	std::vector<double> m_scaleX, m_scaleY, m_scaleZ;
+
+	std::vector<Matrix4> m_matrices;		// Output of updateMatrices()
+	std::vector<TransformId> m_free;		// Destroyed ids, reused by create()
+
+	void computeMatrices(size_t first, size_t last, Matrix4* out) const;
+
+	TransformStorage() {};
+
+public:
+	TransformStorage(const TransformStorage&) = delete;
+	TransformStorage& operator=(const TransformStorage&) = delete;
+
+	static TransformStorage& get();
+
+	/// <summary>
+	/// Returns the number of slots, including destroyed ones waiting for reuse.
+	/// </summary>
+	size_t size() const { return m_translationX.size(); }
+
+	/// <summary>
+	/// Adds an identity transform (no translation or rotation, unit scale).
+	/// </summary>
+	TransformId create();
+	void destroy(TransformId id);
+
+	Vector3 getTranslation(TransformId id) const
+	{
+		return Vector3(m_translationX[id], m_translationY[id], m_translationZ[id]);
+	}
+	void setTranslation(TransformId id, const Vector3& t)
+	{
+		m_translationX[id] = t._x;
+		m_translationY[id] = t._y;
+		m_translationZ[id] = t._z;
+	}
+
+	Rotation getRotation(TransformId id) const;
+	void setRotation(TransformId id, const Rotation& r);
+
+	Vector3 getScale(TransformId id) const
+	{
+		return Vector3(m_scaleX[id], m_scaleY[id], m_scaleZ[id]);
+	}
+	void setScale(TransformId id, const Vector3& s)
+	{
+		m_scaleX[id] = s._x;
+		m_scaleY[id] = s._y;
+		m_scaleZ[id] = s._z;
+	}
+
+	/// <summary>
+	/// Returns the matrix of one transform: translation * rotation * scale.
+	/// </summary>
+	Matrix4 computeMatrix(TransformId id) const;
+
+	/// <summary>
+	/// Recomputes the matrix of every transform, in parallel for large counts. Rotations are kept as
+	/// quaternions so the loop is plain arithmetic with no branches or trigonometry; it reads the
+	/// component arrays front to back and writes the matrices in the same order, so it is bound by
+	/// memory bandwidth.
+	/// </summary>
+	void updateMatrices();
+
+	/// <summary>
+	/// Returns the matrix of a transform as of the last updateMatrices().
+	/// </summary>
+	const Matrix4& getMatrix(TransformId id) const { return m_matrices[id]; }
+};
+
+}
+
+#endif
@@ -1,6 +0,0 @@
-#include "triangle.h"
-
-namespace Graphics {
-using namespace Graphics;
-
-}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include <algorithm>
+#include <cmath>
+
+#include "trianglesetup.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+bool setupTriangle(const Vector3& v1, const Vector3& a, const Vector3& b, TriangleSetup& setup)
+{
+    // Wind counter-clockwise so the inside is where every edge function is positive
+    double area = (a._x - v1._x) * (b._y - v1._y) - (b._x - v1._x) * (a._y - v1._y);
+    if (area == 0.0)
+    {
+        return false;
+    }
+    const Vector3& v2 = area > 0.0 ? a : b;
+    const Vector3& v3 = area > 0.0 ? b : a;
+    area = std::abs(area);
+
+    const Vector3* corners[3] = { &v1, &v2, &v3 };
+    for (int e = 0; e < 3; e++)
+    {
+        const Vector3& from = *corners[e];
+        const Vector3& to = *corners[(e + 1) % 3];
+        setup.edgeA[e] = from._y - to._y;
+        setup.edgeB[e] = to._x - from._x;
+        setup.edgeC[e] = -(setup.edgeA[e] * from._x + setup.edgeB[e] * from._y);
+    }
+
+    setup.depthA = ((v2._z - v1._z) * (v3._y - v1._y) - (v3._z - v1._z) * (v2._y - v1._y)) / area;
+    setup.depthB = ((v2._x - v1._x) * (v3._z - v1._z) - (v3._x - v1._x) * (v2._z - v1._z)) / area;
+    setup.depthC = v1._z - setup.depthA * v1._x - setup.depthB * v1._y;
+
+    setup.minX = std::min({ v1._x, v2._x, v3._x });
+    setup.minY = std::min({ v1._y, v2._y, v3._y });
+    setup.maxX = std::max({ v1._x, v2._x, v3._x });
+    setup.maxY = std::max({ v1._y, v2._y, v3._y });
+    return true;
+}
+
+}
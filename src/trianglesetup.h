@@ -0,0 +1,41 @@
+#ifndef TRIANGLESETUP_H
+#define TRIANGLESETUP_H
+
+#include "vector.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+/// <summary>
+/// Per-triangle setup shared by the depth-only rasterizers. Corners hold screen x, y and inverse
+/// depth. The triangle is wound counter-clockwise, so its inside is where every edge function
+/// e(x, y) = A x + B y + C is non-negative; inverse depth is linear in screen space and stored the
+/// same way.
+/// </summary>
+struct TriangleSetup
+{
+	double edgeA[3];
+	double edgeB[3];
+	double edgeC[3];
+	double depthA;
+	double depthB;
+	double depthC;
+
+	// Screen bounds of the corners
+	double minX;
+	double minY;
+	double maxX;
+	double maxY;
+
+	double getInverseDepth(double x, double y) const { return depthA * x + depthB * y + depthC; }
+};
+
+/// <summary>
+/// Fills in the setup of the given triangle, in either winding.
+/// </summary>
+/// <returns>False, leaving the setup incomplete, if the triangle has no area.</returns>
+bool setupTriangle(const Vector3& v1, const Vector3& v2, const Vector3& v3, TriangleSetup& setup);
+
+}
+
+#endif
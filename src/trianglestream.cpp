@@ -0,0 +1,46 @@
+#include "maths.h"
+#include "trianglestream.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+void TriangleStream::append(const Vector3& v1, const Vector3& v2, const Vector3& v3)
+{
+    if (m_offered++ % m_keepEvery != 0 || m_count >= TRIANGLE_STREAM_MAX_TRIANGLES)
+    {
+        return;
+    }
+
+    // Find the block the next triangle lands in; block b starts at FIRST * (2^b - 1)
+    size_t block = 0;
+    size_t blockStart = 0;
+    while (m_count >= blockStart + getBlockCapacity(block))
+    {
+        blockStart += getBlockCapacity(block);
+        block++;
+    }
+
+    // The last block only needs room for the triangles left under the limit
+    if (m_blocks[block] == nullptr)
+    {
+        size_t capacity = std::min(getBlockCapacity(block), TRIANGLE_STREAM_MAX_TRIANGLES - blockStart);
+        m_blocks[block] = std::make_unique<float[]>(capacity * TRIANGLE_STREAM_STRIDE);
+    }
+
+    // The normal is computed here, once, so drawing the preview doesn't redo it every frame
+    Vector3 normal = cross(v2 - v1, v3 - v1);
+    normal.normalize();
+
+    float* triangle = &m_blocks[block][(m_count - blockStart) * TRIANGLE_STREAM_STRIDE];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        triangle[axis] = (float) v1[axis];
+        triangle[3 + axis] = (float) v2[axis];
+        triangle[6 + axis] = (float) v3[axis];
+        triangle[9 + axis] = (float) normal[axis];
+    }
+
+    m_count++;
+}
+
+}
@@ -0,0 +1,94 @@
+#ifndef TRIANGLESTREAM_H
+#define TRIANGLESTREAM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+
+#include "vector.h"
+
+namespace Graphics {
+using namespace Graphics;
+
+constexpr size_t TRIANGLE_STREAM_FIRST_BLOCK = 1 << 12;	// Triangles in the first block; each block after doubles
+constexpr size_t TRIANGLE_STREAM_MAX_TRIANGLES = 1 << 20;	// About 48 MB; larger loads are subsampled to fit
+constexpr size_t TRIANGLE_STREAM_MAX_BLOCKS = 9;			// Enough blocks to hold the most triangles
+constexpr size_t TRIANGLE_STREAM_STRIDE = 12;			// Floats per triangle
+
+static_assert(TRIANGLE_STREAM_FIRST_BLOCK * ((1 << TRIANGLE_STREAM_MAX_BLOCKS) - 1) >= TRIANGLE_STREAM_MAX_TRIANGLES);
+
+/// <summary>
+/// Append-only triangle buffer filled by a loading thread and drawn by the render thread while
+/// the load is still running. Triangles are stored as twelve floats (three positions, then the
+/// unit face normal) in blocks that never move once allocated. A single writer appends
+/// triangles and then publishes them; readers only ever see the published prefix. It is only a
+/// preview, so it holds at most TRIANGLE_STREAM_MAX_TRIANGLES: a writer that knows roughly how
+/// many triangles are coming keeps every n-th one so the whole model fits, and anything past
+/// the limit is dropped.
+/// </summary>
+class TriangleStream
+{
+	std::array<std::unique_ptr<float[]>, TRIANGLE_STREAM_MAX_BLOCKS> m_blocks;
+	std::atomic<size_t> m_published = 0;
+	size_t m_count = 0;
+	size_t m_offered = 0;						// Triangles passed to append(), kept or not
+	size_t m_keepEvery = 1;
+
+	static size_t getBlockCapacity(size_t block) { return TRIANGLE_STREAM_FIRST_BLOCK << block; }
+
+public:
+	TriangleStream() { };
+
+	TriangleStream(const TriangleStream&) = delete;
+	TriangleStream& operator=(const TriangleStream&) = delete;
+
+	/// <summary>
+	/// Sets about how many triangles will be appended in all, so that an even sample of them
+	/// fits. It may be called again as the estimate improves. Writer only.
+	/// </summary>
+	void setExpectedCount(size_t count)
+	{
+		m_keepEvery = std::max((count + TRIANGLE_STREAM_MAX_TRIANGLES - 1) / TRIANGLE_STREAM_MAX_TRIANGLES, (size_t) 1);
+	}
+
+	/// <summary>
+	/// Appends a triangle to the unpublished tail of the stream, unless it is sampled out or
+	/// the stream is full. Writer only.
+	/// </summary>
+	void append(const Vector3& v1, const Vector3& v2, const Vector3& v3);
+
+	/// <summary>
+	/// Makes every triangle appended so far visible to readers. Writer only.
+	/// </summary>
+	void publish() { m_published.store(m_count, std::memory_order_release); }
+
+	/// <summary>
+	/// Returns the number of triangles readers may draw.
+	/// </summary>
+	size_t getPublishedCount() const { return m_published.load(std::memory_order_acquire); }
+
+	/// <summary>
+	/// Calls func(const float* triangle) for every published triangle, in the order they were
+	/// appended. triangle points to the nine coordinates of its three corners, then its normal.
+	/// </summary>
+	template<typename Func>
+	void forEachPublished(Func&& func) const
+	{
+		size_t remaining = getPublishedCount();
+		for (size_t block = 0; remaining > 0; block++)
+		{
+			const float* triangles = m_blocks[block].get();
+			size_t count = std::min(remaining, getBlockCapacity(block));
+			for (size_t i = 0; i < count; i++)
+			{
+				func(triangles + i * TRIANGLE_STREAM_STRIDE);
+			}
+			remaining -= count;
+		}
+	}
+};
+
+}
+
+#endif // !TRIANGLESTREAM_H